@@ -0,0 +1,15 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+enum AllocSubsystem { ALLOC_CLIENT, ALLOC_LAYER, ALLOC_IPC, ALLOC_CONFIG, ALLOC_LAYOUT, ALLOC_LAST };
+
+// accounted allocations: every block carries a small header with its size and
+// subsystem, so it must be released with alloc_free()/alloc_realloc()
+void* alloc_calloc(enum AllocSubsystem, size_t, size_t);
+void* alloc_realloc(enum AllocSubsystem, void*, size_t);
+char* alloc_strdup(enum AllocSubsystem, const char*);
+void alloc_free(void*);
+
+void alloc_report(void (*)(const char*, void*), void*);
+
+#endif
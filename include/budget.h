@@ -0,0 +1,13 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+// per wl_client limits (client_max_*); the new_* functions return false once
+// the client is over its limit, the caller decides what to refuse. Commits
+// are counted for every surface seen by budget_new_surface()
+void budget_new_surface(struct wlr_surface*);
+bool budget_new_toplevel(struct wlr_xdg_toplevel*);
+bool budget_new_popup(struct wlr_xdg_popup*);
+
+void budget_report(void (*)(const char*, void*), void*);
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
+#define PING_HISTORY 8
+
 struct simple_client {
    struct wl_list link;
    struct simple_output *output;
@@ -20,6 +22,12 @@ struct simple_client {
    struct wl_listener unmap;
    struct wl_listener destroy;
    struct wl_listener commit;
+   struct wl_listener request_fullscreen;
+   struct wl_listener set_title;
+   struct wl_listener set_app_id;
+   struct wl_listener configure;
+   struct wl_listener ack_configure;
+   struct wl_listener ping_timeout;
 //   struct wl_listener decoration_mode;
 //   struct wl_listener decoration_destroy;
 
@@ -30,16 +38,37 @@ struct simple_client {
    struct wl_listener request_activate;
    struct wl_listener request_configure;
    struct wl_listener set_hints;
-   struct wl_listener set_title;
-   struct wl_listener request_fullscreen;
+
+   bool configure_pending;
+   bool configure_reply;
 #endif
 
    uint32_t tag;
    bool fixed;
    bool urgent;
 
+   bool mapped;
    bool visible;
 
+   bool suspend_hidden;
+   bool suspended;
+
+   bool fullscreen;
+   struct wlr_box prev_geom;
+
+   // last rectangle stored in the output's spatial grid
+   struct simple_output *grid_output;
+   struct wlr_box grid_box;
+   unsigned int grid_stamp;
+
+   struct surface_stats stats;
+
+   // xdg_wm_base ping round trips, most recent PING_HISTORY kept
+   bool unresponsive;
+   uint64_t ping_sent;
+   float ping_ms[PING_HISTORY];
+   int n_pings;
+
    // geometry of the wlr_surface within the view as currently displayed
    struct wlr_box geom;
 };
@@ -52,6 +81,10 @@ void cycleClients(struct simple_output*);
 void killClient(struct simple_client*);
 void tileClient(struct simple_client*, enum Direction);
 void maximizeClient(struct simple_client*);
+void setClientFullscreen(struct simple_client*, bool);
+void focusClientInDirection(struct simple_client*, enum Direction);
+void swapClientInDirection(struct simple_client*, enum Direction);
+void forceKillClient(struct simple_client*);
 
 char * get_client_title(struct simple_client*);
 char * get_client_appid(struct simple_client*);
@@ -60,10 +93,18 @@ int get_client_at(double, double, struct simple_client**, struct wlr_surface**,
 int get_client_from_surface(struct wlr_surface*, struct simple_client**, struct simple_layer_surface**);
 void focus_client(struct simple_client*, bool);
 void begin_interactive(struct simple_client*, enum CursorMode, uint32_t);
+void snap_client_position(struct simple_client*);
 
 void get_client_geometry(struct simple_client*, struct wlr_box*);
 void set_client_geometry(struct simple_client*, bool);
 void set_client_border_colour(struct simple_client*, int);
+void set_client_suspended(struct simple_client*, bool);
+
+pid_t get_client_pid(struct simple_client*);
+float get_client_ping_ms(struct simple_client*);
+void ping_client(struct simple_client*);
+void start_ping_timer();
+bool force_kill_pid(pid_t);
 
 void xdg_new_toplevel_notify(struct wl_listener*, void*);
 void xdg_new_popup_notify(struct wl_listener*, void*);
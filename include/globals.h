@@ -13,12 +13,13 @@
 #define LAYER_SHELL_VERSION (4)
 #define COMPOSITOR_VERSION (5)
 #define FRAC_SCALE_VERSION (1)
-#define DWL_IPC_VERSION (2)
+#define DWL_IPC_VERSION (3)
 
 #define N_LAYER_SHELL_LAYERS 4
 
 // macros
-#define LISTEN(E, L, H)    wl_signal_add((E), ((L)->notify = (H), (L)))
+#define LISTEN(E, L, H)    wl_signal_add((E), ((L)->notify = trace_listener((L), (H), #H), (L)))
+#define UNLISTEN(L)        (trace_unlisten(L), wl_list_remove(&(L)->link))
 #define LENGTH(X)          (sizeof X / sizeof X[0])
 #define TAGMASK(T)         (1 << (T))
 #define VISIBLEON(C, O)    ((O) && (C)->output==(O) && ((C)->fixed || ((C)->tag & (O)->visible_tags)))
@@ -37,6 +38,12 @@ enum InputType          { INPUT_POINTER, INPUT_KEYBOARD, INPUT_MISC };
 enum LayerType          { LyrBg, LyrBottom, LyrClient, LyrTop, LyrOverlay, LyrLock, NLayers }; // scene layers
 enum NodeDescriptorType { NODE_CLIENT, NODE_XDG_POPUP, NODE_LAYER_SURFACE, NODE_LAYER_POPUP };
 enum Direction          { LEFT, RIGHT, UP, DOWN };
+enum BufferType         { BUFFER_NONE, BUFFER_SHM, BUFFER_DMABUF, BUFFER_OTHER };
+enum OptionalGlobal     { GLOBAL_SCREENCOPY, GLOBAL_EXPORT_DMABUF, GLOBAL_DATA_CONTROL, GLOBAL_GAMMA_CONTROL,
+                          GLOBAL_OUTPUT_POWER, GLOBAL_IPC, NGLOBALS };
+enum GlobalAccess       { ACCESS_OFF, ACCESS_ON, ACCESS_PRIVILEGED };
+enum RealtimeMode       { REALTIME_OFF, REALTIME_RR, REALTIME_FIFO };
+enum ClientBudget       { BUDGET_SURFACES, BUDGET_WINDOWS, BUDGET_POPUPS, BUDGET_COMMITS, NBUDGET };
 #ifdef XWAYLAND
 enum NetAtoms  {NetWMWindowTypeDialog, NetWMWindowTypeSplash, NetWMWindowTypeToolbar, NetWMWindowTypeUtility, NetLast };
 #endif
@@ -49,20 +56,43 @@ struct simple_config {
    int border_width;
    int tile_gap_width;
    bool sloppy_focus;
+   bool smart_placement;
    int moveresize_step;
+   int snap_distance;
    bool touchpad_tap_click;
+   int xwayland_idle_timeout;
+   int stall_budget_ms;
+   int ping_interval;
+   int ping_timeout_ms;
+   int dispatch_budget_us;
+   int worker_threads;
+   int client_budget[NBUDGET];      // 0 = unlimited
+   bool client_budget_disconnect;
+   bool watch_config;
+   enum RealtimeMode realtime;
+   int realtime_priority;
 
    float background_colour[4];
    float border_colour[NBORDERCOL][4];
 
    char lock_cmd[64];
    char autostart_script[64];
+   char metrics_socket[64];
+   char spawn_cgroup[128];
+
+   enum GlobalAccess global_access[NGLOBALS];
+   char privileged_clients[256];
 
    char xkb_layout[32];
    char xkb_options[32];
 
-   struct wl_list key_bindings;
-   struct wl_list mouse_bindings;
+   const struct keymap *key_bindings;
+   int n_key_bindings;
+   const struct mousemap *mouse_bindings;
+   int n_mouse_bindings;
+
+   struct rule_set *rules;
+   struct config_arena *arena;
 };
 
 struct keymap {
@@ -70,8 +100,6 @@ struct keymap {
    xkb_keysym_t keysym;
    int keyfn;
    char argument[64];
-   
-   struct wl_list link;
 };
 
 struct mousemap {
@@ -79,8 +107,26 @@ struct mousemap {
    uint32_t button;
    int context;
    char argument[64];
-   
-   struct wl_list link;
+};
+
+// per surface counters, kept in simple_client and simple_layer_surface
+struct surface_stats {
+   uint64_t commits;
+   uint64_t window_start;        // ns, commits are counted per one second window
+   unsigned int window_commits;
+   float commits_per_sec;
+
+   uint64_t damage_total;        // buffer pixels damaged over all commits
+   uint64_t damage_last;
+
+   enum BufferType buffer_type;
+   int buffer_width, buffer_height;
+
+   uint32_t configure_serial;    // last configure sent, 0 once acked
+   uint64_t configure_time;
+   float configure_ack_ms;
+
+   float frame_commit_ms;        // from the output's last frame done to this commit
 };
 
 //--- global variables -----
@@ -91,10 +137,38 @@ extern struct simple_config* g_config;
 //--- functions in config.c -----
 void readConfiguration(char*);
 void reloadConfiguration();
+void config_watch_update();
+void config_watch_finish();
+
+//--- functions in log.c -----
+// Messages below MIN_LOG_LEVEL are compiled out, and the arguments of messages
+// below the runtime level are never evaluated. ERROR always prints and exits.
+#ifndef MIN_LOG_LEVEL
+#define MIN_LOG_LEVEL DEBUG
+#endif
+#define LOG_ENABLED(L)     ((L)==ERROR || ((L)>=MIN_LOG_LEVEL && (L)>=g_say_level))
+#define say(L, ...)        do { if(LOG_ENABLED(L)) say_impl((L), __VA_ARGS__); } while(0)
 
-//--- functions in main.c -----
-void say(int, const char*, ...);
+extern int g_say_level;
+void say_impl(int, const char*, ...);
+
+//--- functions in trace.c -----
+wl_notify_func_t trace_listener(struct wl_listener*, wl_notify_func_t, const char*);
+void trace_unlisten(struct wl_listener*);
+
+//--- functions in stats.c -----
+// startup phases, reported with --debug and the "startup" action
+void startup_mark(const char*);
+void startup_report(void (*)(const char*, void*), void*);
+
+//--- functions in spawn.c -----
 void spawn(char*);
+void report_children(void (*)(const char*, void*), void*);
+void spawn_helper_start(const char*);
+void spawn_helper_finish();
+void spawn_listen(struct wl_event_loop*);
+
+//--- functions in main.c -----
 void send_signal(int);
 
 #endif
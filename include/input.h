@@ -15,5 +15,6 @@ struct simple_input {
 void input_focus_surface(struct wlr_surface*);
 
 void input_init();
+void update_input_devices(bool, bool);
 
 #endif
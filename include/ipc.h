@@ -1,14 +1,33 @@
 #ifndef IPC_H
 #define IPC_H
 
+#define IPC_MAX_TAGS 32
+
+struct ipc_tag_status {
+   uint32_t state;
+   uint32_t numclients;
+   uint32_t focused;
+};
+
 struct simple_ipc_output {
    struct wl_list link;
    struct wl_resource *resource;
    struct simple_output* output;
+
+   // status last sent to this watcher, only what changed is sent again
+   bool dirty;
+   bool sent;
+   bool active;
+   bool fullscreen;
+   struct ipc_tag_status tags[IPC_MAX_TAGS];
+   char *title;
+   char *appid;
 };
 
 void ipc_manager_bind(struct wl_client*, void*, uint32_t, uint32_t);
 
 void ipc_output_printstatus(struct simple_output*);
+void ipc_flush_status();
+void ipc_reply(const char*);
 
 #endif
@@ -18,12 +18,14 @@ struct simple_layer_surface {
    struct wl_listener new_popup;
 
    bool mapped;
+   struct surface_stats stats;
 
    // geometry of the wlr_surface within the view as currently displayed
    struct wlr_box geom;
 };
 
 void arrange_layers(struct simple_output*);
+void set_layers_enabled(struct simple_output*, bool);
 void layer_new_surface_notify(struct wl_listener*, void*);
 
 #endif
@@ -0,0 +1,11 @@
+#ifndef LOG_H
+#define LOG_H
+
+#define LOG_RING_SIZE 512        // power of two
+#define LOG_RING_ARGS 8
+#define LOG_RING_STRINGS 96      // copies of %s arguments
+
+void log_set_levels(int, int);
+void log_ring_dump(void (*)(const char*, void*), void*);
+
+#endif
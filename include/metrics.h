@@ -0,0 +1,7 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+void metrics_start(const char*);
+void metrics_finish();
+
+#endif
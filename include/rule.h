@@ -0,0 +1,11 @@
+#ifndef RULE_H
+#define RULE_H
+
+struct rule_set* rule_set_create();
+bool rule_set_add(struct rule_set*, char*);
+bool rule_set_compile(struct rule_set*);
+void rule_set_destroy(struct rule_set*);
+
+bool apply_client_rules(struct simple_client*);
+
+#endif
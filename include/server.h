@@ -9,11 +9,14 @@
 struct simple_server {
    struct wl_display *display;
    struct wl_event_loop *event_loop;
+   struct wl_event_loop *input_loop;   // backend, session and libinput, dispatched first
+   bool running;
 
    struct wlr_backend *backend;
    struct wlr_renderer *renderer;
    struct wlr_allocator *allocator;
    struct wlr_compositor *compositor;
+   struct wl_listener new_surface;
 
    struct wlr_scene *scene;
    struct wlr_scene_tree *layer_tree[NLayers];
@@ -42,6 +45,7 @@ struct simple_server {
    struct wl_listener xdg_new_toplevel;
    struct wl_listener xdg_new_popup;
 #if XWAYLAND
+   struct wlr_xwayland_server *xwayland_server;
    struct wlr_xwayland *xwayland;
    struct wl_listener xwl_new_surface;
    struct wl_listener xwl_ready;
@@ -99,6 +103,9 @@ struct simple_server {
    struct wlr_gamma_control_manager_v1 *gamma_control_manager;
    struct wl_listener set_gamma;
 
+   // globals that can be switched off or limited to privileged clients, NULL while absent
+   struct wl_global *optional_globals[NGLOBALS];
+
    // background layer
    struct wlr_scene_rect *root_bg;
 
@@ -107,6 +114,26 @@ struct simple_server {
    double grab_x, grab_y;
    struct wlr_box grab_box;
    uint32_t resize_edges;
+
+   // sorted edges to snap to during an interactive move
+   struct snap_edges {
+      int *x, *y;
+      int n_x, n_y;
+      int capacity;
+   } snap;
+
+   // running totals, read by the metrics exporter
+   struct server_counters {
+      uint64_t frames;
+      uint64_t frame_ns;
+      uint64_t key_events;
+      uint64_t pointer_events;
+      uint64_t ipc_requests;
+      uint64_t ipc_frames;
+   } counters;
+
+   // globals not needed for the first frame are created once it is out
+   bool first_frame_done;
 };
 
 struct simple_output {
@@ -130,7 +157,11 @@ struct simple_output {
    struct wlr_box full_area;
    struct wlr_box usable_area;
 
+   struct spatial_grid *grid;
+   struct simple_client *fullscreen_client;
+
    bool gamma_lut_changed;
+   uint64_t last_frame_ns;    // last frame done sent to surfaces on this output
 };
 
 struct client_outline {
@@ -164,8 +195,10 @@ void arrange_output(struct simple_output*);
 
 void prepareServer();
 void startServer(char*);
+void runServer();
 void cleanupServer();
 
 void set_output_state(bool);
+void global_filter_reset();
 
 #endif
@@ -0,0 +1,28 @@
+#ifndef SPATIAL_H
+#define SPATIAL_H
+
+#define SPATIAL_CELL_SIZE 256
+
+// uniform grid of client rectangles (borders included), one per output
+struct spatial_cell {
+   struct simple_client **clients;
+   int n, capacity;
+};
+
+struct spatial_grid {
+   struct wlr_box area;
+   int cols, rows;
+   struct spatial_cell *cells;
+};
+
+struct spatial_grid* spatial_grid_create(struct wlr_box*);
+void spatial_grid_destroy(struct spatial_grid*);
+void spatial_grid_rebuild(struct simple_output*, struct wlr_box*);
+
+void spatial_update_client(struct simple_client*);
+void spatial_remove_client(struct simple_client*);
+
+struct simple_client* spatial_client_in_direction(struct simple_client*, enum Direction);
+long spatial_overlap_area(struct simple_output*, struct wlr_box*, struct simple_client*);
+
+#endif
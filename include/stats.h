@@ -0,0 +1,10 @@
+#ifndef STATS_H
+#define STATS_H
+
+uint64_t stats_now();
+void surface_stats_commit(struct surface_stats*, struct wlr_surface*, struct simple_output*);
+void surface_stats_configure(struct surface_stats*, uint32_t);
+void surface_stats_ack(struct surface_stats*, uint32_t);
+void surface_stats_format(struct surface_stats*, char*, size_t);
+
+#endif
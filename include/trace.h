@@ -0,0 +1,24 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+struct trace_stats {
+   unsigned long stalls;
+   uint64_t worst_ns;
+   const char *worst_name;
+};
+
+bool trace_start(const char*);
+void trace_finish();
+bool trace_enabled();
+void trace_watchdog(int);
+void trace_get_stats(struct trace_stats*);
+
+void trace_dispatch_begin(const char*);
+void trace_dispatch_end();
+
+uint64_t trace_begin(const char*);
+void trace_end(const char*, uint64_t);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+// a fixed pool of threads for blocking or CPU heavy jobs; run() is called on a
+// worker, done() later on the compositor thread from the event loop, or cancel()
+// instead when the pool is finished first. Without threads (worker_threads = 0)
+// run() and done() are called right away
+void worker_pool_start(int);
+void worker_pool_listen(struct wl_event_loop*);
+void worker_pool_finish();
+void worker_submit(void (*)(void*), void (*)(void*), void (*)(void*), void*);
+
+#endif
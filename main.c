@@ -3,92 +3,104 @@
  *   - Main SimpleWC Program
  */
 
+#define _GNU_SOURCE  // SCHED_RESET_ON_FORK
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
-#include <sys/wait.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <linux/capability.h>
 #include <wlr/util/log.h>
 
 #include "globals.h"
 #include "server.h"
+#include "log.h"
+#include "trace.h"
+#include "worker.h"
 
-#define CRED      "\033[31m"
-#define CGREEN    "\033[32m"
-#define CYELLOW   "\033[33m"
-#define CBLUE     "\033[34m"
-#define CPURPLE   "\033[35m"
-#define CRESET    "\033[0m"
-
-static const char *msg_str[NMSG] = { CBLUE"DEBUG"CRESET, "INFO", CYELLOW"WARNING"CRESET, CRED"ERROR"CRESET };
 static int info_level = WLR_SILENT;
 
 struct wlr_session *g_session;
 struct simple_server* g_server;
 struct simple_config* g_config;
 
+// delivered through signalfd from the event loop
+static const int loop_signals[] = { SIGCHLD, SIGINT, SIGTERM, SIGUSR1 };
+
+// faulted in before locking, so handlers don't page fault on a cold stack or heap
+#define PREFAULT_STACK  (256*1024)
+#define PREFAULT_HEAP   (8*1024*1024)
+
 //------------------------------------------------------------------------
-void 
-say(int level, const char* message, ...) 
+static int
+terminate_notify(int sig, void *data)
 {
-   if(level==DEBUG && info_level!=WLR_DEBUG) return;
-
-   char buffer[256];
-   va_list args;
-   va_start(args, message);
-   vsnprintf(buffer, 256, message, args);
-   va_end(args);
+   say(INFO, "Received signal %d, terminating", sig);
+   g_server->running = false;
+   return 0;
+}
 
-   printf("SimpleWC [%s]: %s\n", msg_str[level], buffer);
-   //wlr_log(WLR_INFO, " [%s]: %s", msg_str[level], buffer);
+static void
+prefault_stack()
+{
+   volatile char stack[PREFAULT_STACK];
+   for(size_t i=0; i<sizeof stack; i+=4096) stack[i] = 0;
+}
 
-   if(level==ERROR) exit(EXIT_FAILURE);
+// RLIMIT_MEMLOCK is unlimited, or CAP_IPC_LOCK lets us ignore it
+static bool
+can_lock_unlimited()
+{
+   struct rlimit limit;
+   if(!getrlimit(RLIMIT_MEMLOCK, &limit) && limit.rlim_cur==RLIM_INFINITY) return true;
+
+   char line[128];
+   unsigned long long caps = 0;
+   FILE *status = fopen("/proc/self/status", "r");
+   if(!status) return false;
+   while(fgets(line, sizeof line, status))
+      if(sscanf(line, "CapEff: %llx", &caps)==1) break;
+   fclose(status);
+   return caps & (1ull << CAP_IPC_LOCK);
 }
 
-void 
-spawn(char* cmd) 
+// Only this thread is made real-time; the trace and watchdog threads are
+// already running. SCHED_RESET_ON_FORK gives forked children normal
+// scheduling, and memory locks are not inherited, so spawned programs and
+// the spawn helper (started before this) run as usual.
+static void
+enter_realtime(enum RealtimeMode mode, int priority)
 {
-   char *sh = NULL;
-   if(!(sh=getenv("SHELL"))) sh = (char*)"/bin/sh";
-
-   say(DEBUG, "Spawn %s", cmd);
-   /*
-   pid_t pid = fork();
-   if(pid==0){
-      pid_t child;
-      setsid();
-      sigset_t set;
-      sigemptyset(&set);
-      sigprocmask(SIG_SETMASK, &set, NULL);
-      if((child=fork())==0){
-         execl(sh, sh, "-c", cmd, (char*) NULL);
-         exit(0);
-      }
-      exit(0);
+   if(mode==REALTIME_OFF) return;
+
+   struct sched_param param = { .sched_priority = priority };
+   int policy = mode==REALTIME_FIFO ? SCHED_FIFO : SCHED_RR;
+   if(sched_setscheduler(0, policy | SCHED_RESET_ON_FORK, &param)) {
+      say(WARNING, "Cannot set real-time scheduling: %s", strerror(errno));
+      return;
    }
-   //waitpid(pid, NULL, 0);
-   */
-   // from dwl:
-   if(fork()==0) {
-      dup2(STDERR_FILENO, STDOUT_FILENO);
-      setsid();
-      execl(sh, sh, "-c", cmd, (char*) NULL);
-      say(DEBUG, "execl %s failed", cmd);
+
+   // faulted in now so MCL_CURRENT covers it; with mmap off and no trimming
+   // the pre-faulted heap stays in place for later allocations
+   mallopt(M_TRIM_THRESHOLD, -1);
+   mallopt(M_MMAP_MAX, 0);
+   prefault_stack();
+   char *heap = malloc(PREFAULT_HEAP);
+   if(heap) {
+      for(size_t i=0; i<PREFAULT_HEAP; i+=4096) heap[i] = 0;
+      free(heap);
    }
-}
 
-void 
-signal_handler(int sig) 
-{
-   if(sig == SIGCHLD) {
-#if XWAYLAND
-      siginfo_t in;
-      while (  !waitid(P_ALL, 0, &in, WEXITED|WNOHANG|WNOWAIT) 
-               && in.si_pid
-               && (!g_server->xwayland || in.si_pid != g_server->xwayland->server->pid) )
-         waitpid(in.si_pid, NULL, 0);
-#else
-      while (0 < waitpid(-1, NULL, WNOHANG));
-#endif
-   } else if (sig == SIGINT || sig == SIGTERM )
-      wl_display_terminate(g_server->display);
+   // with a finite limit MCL_FUTURE makes brk and mmap fail once it is reached
+   bool future = can_lock_unlimited();
+   if(mlockall(MCL_CURRENT | (future ? MCL_FUTURE : 0)))
+      say(WARNING, "Cannot lock memory: %s", strerror(errno));
+   else
+      say(INFO, "Locked %s memory", future ? "current and future" : "current (pre-faulted)");
+   say(INFO, "Running with %s priority %d", mode==REALTIME_FIFO ? "SCHED_FIFO" : "SCHED_RR", priority);
 }
 
 //--- Main function ------------------------------------------------------
@@ -97,6 +109,9 @@ main(int argc, char **argv)
 {
    char config_file[64] = { '\0' };
    char start_cmd[64] = { '\0' };
+   char *trace_file = NULL;
+
+   startup_mark("main");
 
    // Parse arguments
    for(int i=1; i<argc; i++){
@@ -109,13 +124,20 @@ main(int argc, char **argv)
       }
       else if(!strcmp(iarg, "--debug")) {
          info_level = WLR_DEBUG;
+         log_set_levels(DEBUG, DEBUG);
+      }
+      else if(!strcmp(iarg, "--trace") && ((i+1)<argc)) {
+         trace_file = argv[++i];
+      }
+      else if(!strcmp(iarg, "--debug-ring")) {
+         log_set_levels(INFO, DEBUG);
       }
       else if(!strcmp(iarg, "--version")) {
          say(INFO, "Version-"VERSION);
          exit(EXIT_SUCCESS);
       }
       else if(!strcmp(iarg, "--help")) {
-         say(INFO, "Usage: %s [--config file][--start cmd][--debug][--version][--help]", argv[0]);
+         say(INFO, "Usage: %s [--config file][--start cmd][--debug][--debug-ring][--trace file][--version][--help]", argv[0]);
          exit(EXIT_SUCCESS);
       }
    }
@@ -126,35 +148,52 @@ main(int argc, char **argv)
    if(!getenv("XDG_RUNTIME_DIR"))
       say(ERROR, "XDG_RUNTIME_DIR must be set!");
 
-   // Handle signals
-   int signals[] = { SIGCHLD, SIGINT, SIGTERM, SIGPIPE };
-   struct sigaction sa;
-   sigemptyset(&sa.sa_mask);
-   sa.sa_flags = 0;
-   sa.sa_handler = signal_handler;
+   // Handle signals from the event loop. They are blocked before any thread
+   // is started, so no other thread can take them first
+   sigset_t set;
+   sigemptyset(&set);
+   for(int i=0; i<LENGTH(loop_signals); i++)
+      sigaddset(&set, loop_signals[i]);
+   pthread_sigmask(SIG_BLOCK, &set, NULL);
 
-   for(int i=0; i<LENGTH(signals); i++)
-      sigaction(signals[i], &sa, NULL);
+   // a client closing its socket must not kill the compositor
+   signal(SIGPIPE, SIG_IGN);
 
    // Start WLR logging
    wlr_log_init(info_level, NULL);
 
    // Read in config
-   if(!(g_config = calloc(1, sizeof(struct simple_config))))
-      say(ERROR, "Cannot allocate g_config");
    readConfiguration(config_file);
+   startup_mark("config");
+
+   // forked while the compositor is still small and has no threads
+   spawn_helper_start(g_config->spawn_cgroup);
+   // before any real-time switch, so the workers keep normal scheduling
+   worker_pool_start(g_config->worker_threads);
 
    // Create a server
    if(!(g_server = calloc(1, sizeof(struct simple_server))))
       say(ERROR, "Cannot allocate g_server");
+   // listeners are wrapped when registered, so tracing starts before any LISTEN()
+   if(trace_file) trace_start(trace_file);
+   trace_watchdog(g_config->stall_budget_ms);
    prepareServer();
+
+   spawn_listen(g_server->event_loop);
+   worker_pool_listen(g_server->event_loop);
+   wl_event_loop_add_signal(g_server->event_loop, SIGINT, terminate_notify, NULL);
+   wl_event_loop_add_signal(g_server->event_loop, SIGTERM, terminate_notify, NULL);
    
    startServer(start_cmd);
+   enter_realtime(g_config->realtime, g_config->realtime_priority);
 
    // Run the main Wayland event loop
-   wl_display_run(g_server->display);
+   runServer();
    
+   spawn_helper_finish();
+   worker_pool_finish();
    cleanupServer();
+   trace_finish();
      
    return EXIT_SUCCESS;
 }
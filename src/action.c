@@ -3,18 +3,91 @@
 #include <wlr/backend/session.h>
 #include <wlr/types/wlr_scene.h>
 #include <wlr/types/wlr_seat.h>
+#include <wlr/types/wlr_xdg_shell.h>
 #include <wlr/util/box.h>
 
 #include "globals.h"
 #include "layer.h"
 #include "client.h"
 #include "server.h"
+#include "ipc.h"
+#include "log.h"
+#include "trace.h"
+#include "stats.h"
+#include "alloc.h"
+#include "budget.h"
+
+static void
+reply_line(const char *line, void *data)
+{
+   ipc_reply(line);
+}
+
+static void
+reply_stats()
+{
+   char line[128];
+   struct trace_stats stats;
+   trace_get_stats(&stats);
+
+   snprintf(line, sizeof line, "stalls %lu (worst %.1f ms in %s)", stats.stalls, 
+         stats.worst_ns/1e6, stats.worst_name ? stats.worst_name : "-");
+   ipc_reply(line);
+}
+
+static void
+reply_client_stats()
+{
+   char line[512], stats[384];
+   struct simple_client *client;
+   struct simple_output *output;
+   struct simple_layer_surface *lsurface;
+
+   wl_list_for_each(client, &g_server->clients, link) {
+      char *appid = get_client_appid(client);
+      surface_stats_format(&client->stats, stats, sizeof stats);
+      snprintf(line, sizeof line, "client %s (pid %d): %s, ping %.2f ms%s", appid ? appid : "-", 
+            get_client_pid(client), stats, get_client_ping_ms(client), client->unresponsive ? ", NOT RESPONDING" : "");
+      ipc_reply(line);
+   }
+
+   wl_list_for_each(output, &g_server->outputs, link) {
+      for(int i=0; i<N_LAYER_SHELL_LAYERS; i++) {
+         wl_list_for_each(lsurface, &output->layer_shells[i], link) {
+            const char *namespace = lsurface->scene_layer_surface->layer_surface->namespace;
+            surface_stats_format(&lsurface->stats, stats, sizeof stats);
+            snprintf(line, sizeof line, "layer %s: %s", namespace ? namespace : "-", stats);
+            ipc_reply(line);
+         }
+      }
+   }
+}
+
+static void
+pingClients()
+{
+   struct simple_client *client;
+   wl_list_for_each(client, &g_server->clients, link)
+      ping_client(client);
+}
+
+static int
+keysym_to_direction(xkb_keysym_t keysym)
+{
+   switch(keysym) {
+      case XKB_KEY_Left:   return LEFT;
+      case XKB_KEY_Right:  return RIGHT;
+      case XKB_KEY_Up:     return UP;
+      case XKB_KEY_Down:   return DOWN;
+   }
+   return -1;
+}
 
 void 
-key_function(struct keymap *keymap) 
+key_function(const struct keymap *keymap) 
 {
    //--- QUIT -----
-   if(keymap->keyfn==QUIT)    wl_display_terminate(g_server->display);
+   if(keymap->keyfn==QUIT)    g_server->running = false;
    
    //--- LOCK -----
    if(keymap->keyfn==LOCK)    spawn(g_config->lock_cmd);
@@ -46,9 +119,15 @@ key_function(struct keymap *keymap)
       if(!strcmp(keymap->argument, "toggle_fixed"))   toggleClientFixed(client);
       if(!strcmp(keymap->argument, "toggle_visible")) toggleClientVisible(client);
       if(!strcmp(keymap->argument, "kill"))           killClient(client);
+      if(!strcmp(keymap->argument, "force_kill"))     forceKillClient(client);
       if(!strcmp(keymap->argument, "maximize"))       maximizeClient(client);
+      if(!strcmp(keymap->argument, "toggle_fullscreen")) setClientFullscreen(client, !client->fullscreen);
       if(!strcmp(keymap->argument, "tile_left"))      tileClient(client, LEFT);
       if(!strcmp(keymap->argument, "tile_right"))     tileClient(client, RIGHT);
+      if(!strcmp(keymap->argument, "focus") && keysym_to_direction(keymap->keysym)>=0)
+         focusClientInDirection(client, keysym_to_direction(keymap->keysym));
+      if(!strcmp(keymap->argument, "swap") && keysym_to_direction(keymap->keysym)>=0)
+         swapClientInDirection(client, keysym_to_direction(keymap->keysym));
       if(!strcmp(keymap->argument, "move")){
          if(keymap->keysym==XKB_KEY_Left)    client->geom.x-=g_config->moveresize_step;
          if(keymap->keysym==XKB_KEY_Right)   client->geom.x+=g_config->moveresize_step;
@@ -69,7 +148,7 @@ key_function(struct keymap *keymap)
 }
 
 void 
-mouse_function(struct simple_client *client, struct mousemap *mousemap, int resize_edges)
+mouse_function(struct simple_client *client, const struct mousemap *mousemap, int resize_edges)
 {
    if(mousemap->context==CONTEXT_ROOT){
       if(!strcmp(mousemap->argument, "test"))   say(INFO, "test()");
@@ -85,9 +164,19 @@ void
 process_ipc_action(const char* action)
 {
    if(!strcmp(action, "test"))      say(INFO, "Action test");
-   if(!strcmp(action, "quit"))      wl_display_terminate(g_server->display);
+   if(!strcmp(action, "quit"))      g_server->running = false;
    if(!strcmp(action, "lock"))      spawn(g_config->lock_cmd);
    if(!strcmp(action, "reconfig"))  reloadConfiguration();
+   if(!strcmp(action, "log"))       log_ring_dump(reply_line, NULL);
+   if(!strcmp(action, "stats"))     reply_stats();
+   if(!strcmp(action, "client_stats")) reply_client_stats();
+   if(!strcmp(action, "memory"))    alloc_report(reply_line, NULL);
+   if(!strcmp(action, "children"))  report_children(reply_line, NULL);
+   if(!strcmp(action, "startup"))   startup_report(reply_line, NULL);
+   if(!strcmp(action, "budgets"))   budget_report(reply_line, NULL);
+   if(!strcmp(action, "ping"))      pingClients();
+   if(!strncmp(action, "force_kill ", 11) && !force_kill_pid(atoi(action+11)))
+      ipc_reply("force_kill: no client with this pid");
 
    if(!strcmp(action, "output_off"))   set_output_state(false);
    if(!strcmp(action, "output_on"))    set_output_state(true);
@@ -0,0 +1,156 @@
+#include <malloc.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <wlr/backend/session.h>
+#include <wlr/types/wlr_scene.h>
+
+#include "globals.h"
+#include "layer.h"
+#include "client.h"
+#include "server.h"
+#include "alloc.h"
+
+// keeps the returned block aligned like malloc's own
+struct alloc_header {
+   alignas(max_align_t) size_t size;
+   enum AllocSubsystem subsystem;
+};
+
+struct alloc_counter {
+   atomic_size_t bytes;
+   atomic_size_t blocks;
+};
+
+static const char *subsystem_str[] = { "clients", "layers", "ipc", "config", "layout" };
+static struct alloc_counter counters[ALLOC_LAST];
+
+static void
+account(enum AllocSubsystem subsystem, size_t size, int sign)
+{
+   if(sign>0) {
+      atomic_fetch_add_explicit(&counters[subsystem].bytes, size, memory_order_relaxed);
+      atomic_fetch_add_explicit(&counters[subsystem].blocks, 1, memory_order_relaxed);
+   } else {
+      atomic_fetch_sub_explicit(&counters[subsystem].bytes, size, memory_order_relaxed);
+      atomic_fetch_sub_explicit(&counters[subsystem].blocks, 1, memory_order_relaxed);
+   }
+}
+
+//------------------------------------------------------------------------
+void*
+alloc_calloc(enum AllocSubsystem subsystem, size_t n, size_t size)
+{
+   if(size && n > (SIZE_MAX - sizeof(struct alloc_header))/size) return NULL;
+
+   struct alloc_header *header = calloc(1, sizeof(struct alloc_header) + n*size);
+   if(!header) return NULL;
+
+   header->size = n*size;
+   header->subsystem = subsystem;
+   account(subsystem, header->size, 1);
+   return header + 1;
+}
+
+void*
+alloc_realloc(enum AllocSubsystem subsystem, void *ptr, size_t size)
+{
+   if(!ptr) return alloc_calloc(subsystem, 1, size);
+
+   struct alloc_header *header = (struct alloc_header*)ptr - 1;
+   size_t old_size = header->size;
+   enum AllocSubsystem old_subsystem = header->subsystem;
+
+   struct alloc_header *new_header = realloc(header, sizeof(struct alloc_header) + size);
+   if(!new_header) return NULL;
+
+   account(old_subsystem, old_size, -1);
+   new_header->size = size;
+   new_header->subsystem = subsystem;
+   account(subsystem, size, 1);
+   return new_header + 1;
+}
+
+char*
+alloc_strdup(enum AllocSubsystem subsystem, const char *str)
+{
+   size_t len = strlen(str) + 1;
+   char *copy = alloc_calloc(subsystem, 1, len);
+   if(copy) memcpy(copy, str, len);
+   return copy;
+}
+
+void
+alloc_free(void *ptr)
+{
+   if(!ptr) return;
+
+   struct alloc_header *header = (struct alloc_header*)ptr - 1;
+   account(header->subsystem, header->size, -1);
+   free(header);
+}
+
+//------------------------------------------------------------------------
+static void
+count_scene_nodes(struct wlr_scene_node *node, size_t count[3])
+{
+   switch(node->type) {
+      case WLR_SCENE_NODE_TREE: {
+         count[0]++;
+         struct wlr_scene_tree *tree = wlr_scene_tree_from_node(node);
+         struct wlr_scene_node *child;
+         wl_list_for_each(child, &tree->children, link)
+            count_scene_nodes(child, count);
+         break;
+      }
+      case WLR_SCENE_NODE_RECT:     count[1]++; break;
+      case WLR_SCENE_NODE_BUFFER:   count[2]++; break;
+   }
+}
+
+void
+alloc_report(void (*emit)(const char*, void*), void *data)
+{
+   char line[256];
+   size_t total = 0;
+
+   for(int i=0; i<ALLOC_LAST; i++) {
+      size_t bytes = atomic_load_explicit(&counters[i].bytes, memory_order_relaxed);
+      size_t blocks = atomic_load_explicit(&counters[i].blocks, memory_order_relaxed);
+      snprintf(line, sizeof line, "%s: %zu bytes in %zu blocks", subsystem_str[i], bytes, blocks);
+      emit(line, data);
+      total += bytes;
+   }
+
+   // scene nodes are allocated by wlroots, so they are counted by walking the graph
+   size_t nodes[3] = {0};
+   count_scene_nodes(&g_server->scene->tree.node, nodes);
+   size_t scene_bytes = nodes[0]*sizeof(struct wlr_scene_tree) + nodes[1]*sizeof(struct wlr_scene_rect)
+      + nodes[2]*sizeof(struct wlr_scene_buffer);
+   snprintf(line, sizeof line, "scene: ~%zu bytes in %zu trees, %zu rects, %zu buffers", 
+         scene_bytes, nodes[0], nodes[1], nodes[2]);
+   emit(line, data);
+
+   // client buffers live in the clients' own memory (shm or GPU), estimated at 4 bytes per pixel
+   size_t buffer_total = 0;
+   struct simple_client *client;
+   wl_list_for_each(client, &g_server->clients, link) {
+      size_t bytes = (size_t)client->stats.buffer_width * client->stats.buffer_height * 4;
+      char *appid = get_client_appid(client);
+      snprintf(line, sizeof line, "buffer %s (pid %d): %zu bytes", appid ? appid : "-", get_client_pid(client), bytes);
+      emit(line, data);
+      buffer_total += bytes;
+   }
+
+   snprintf(line, sizeof line, "total: %zu bytes accounted, %zu bytes in client buffers", total, buffer_total);
+   emit(line, data);
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+   struct mallinfo2 info = mallinfo2();
+   snprintf(line, sizeof line, "malloc: %zu bytes in use, %zu free, %zu arena, %zu mmapped", 
+         info.uordblks, info.fordblks, info.arena, info.hblkhd);
+   emit(line, data);
+#endif
+}
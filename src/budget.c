@@ -0,0 +1,212 @@
+#include <string.h>
+#include <wlr/backend/session.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_xdg_shell.h>
+
+#include "globals.h"
+#include "layer.h"
+#include "client.h"
+#include "server.h"
+#include "stats.h"
+#include "budget.h"
+#include "alloc.h"
+
+#define NS_PER_SEC 1000000000ull
+
+// usage and breaches of one wl_client, found again through its destroy listener
+struct client_budget {
+   struct wl_client *client;
+   pid_t pid;
+
+   int used[NBUDGET];
+   unsigned long breaches[NBUDGET];
+   uint64_t window_start;        // ns, commits are counted per one second window
+   bool disconnect;
+
+   struct wl_list resources;     // budget_resource.link
+   struct wl_list link;
+   struct wl_listener destroy;
+};
+
+// one surface, window or popup counted against a budget
+struct budget_resource {
+   struct client_budget *budget; // NULL once the client is gone
+   enum ClientBudget kind;
+   struct wl_list link;
+   struct wl_listener destroy;
+   struct wl_listener commit;    // surfaces only
+};
+
+static const char *budget_str[] = { "surfaces", "windows", "popups", "commits/s" };
+
+static struct wl_list budgets = { &budgets, &budgets };
+static struct wl_event_source *disconnect_idle;
+
+//------------------------------------------------------------------------
+static void
+budget_destroy_notify(struct wl_listener *listener, void *data)
+{
+   struct client_budget *budget = wl_container_of(listener, budget, destroy);
+   struct budget_resource *res, *tmp;
+
+   // the client's resources are destroyed after it, they must not come back here
+   wl_list_for_each_safe(res, tmp, &budget->resources, link) {
+      res->budget = NULL;
+      wl_list_remove(&res->link);
+      wl_list_init(&res->link);
+   }
+   wl_list_remove(&budget->destroy.link);
+   wl_list_remove(&budget->link);
+   alloc_free(budget);
+}
+
+static struct client_budget*
+get_budget(struct wl_client *client)
+{
+   struct client_budget *budget;
+   struct wl_listener *listener = wl_client_get_destroy_listener(client, budget_destroy_notify);
+   if(listener) return wl_container_of(listener, budget, destroy);
+
+#if XWAYLAND
+   // Xwayland speaks for all X11 clients at once
+   if(g_server->xwayland_server && client==g_server->xwayland_server->client) return NULL;
+#endif
+
+   if(!(budget = alloc_calloc(ALLOC_CLIENT, 1, sizeof(struct client_budget)))) return NULL;
+
+   budget->client = client;
+   wl_client_get_credentials(client, &budget->pid, NULL, NULL);
+   wl_list_init(&budget->resources);
+   wl_list_insert(&budgets, &budget->link);
+
+   // not LISTEN(), the listener is looked up by its notify function
+   budget->destroy.notify = budget_destroy_notify;
+   wl_client_add_destroy_listener(client, &budget->destroy);
+   return budget;
+}
+
+static void
+disconnect_notify(void *data)
+{
+   struct client_budget *budget, *tmp;
+   disconnect_idle = NULL;
+
+   wl_list_for_each_safe(budget, tmp, &budgets, link) {
+      if(!budget->disconnect) continue;
+      say(WARNING, "Disconnecting client pid %d for exceeding its budget", budget->pid);
+      wl_client_post_implementation_error(budget->client, "client budget exceeded");
+      wl_client_destroy(budget->client);
+   }
+}
+
+// false if the client is over its limit for this kind
+static bool
+budget_check(struct client_budget *budget, enum ClientBudget kind)
+{
+   int limit = g_config->client_budget[kind];
+   if(!limit || budget->used[kind] <= limit) return true;
+
+   if(!budget->breaches[kind]++)
+      say(WARNING, "Client pid %d is over its budget of %d %s", budget->pid, limit, budget_str[kind]);
+
+   // not from inside the request that went over, the client's objects are still in use
+   if(g_config->client_budget_disconnect && !budget->disconnect) {
+      budget->disconnect = true;
+      if(!disconnect_idle)
+         disconnect_idle = wl_event_loop_add_idle(g_server->event_loop, disconnect_notify, NULL);
+   }
+   return false;
+}
+
+static void
+resource_destroy_notify(struct wl_listener *listener, void *data)
+{
+   struct budget_resource *res = wl_container_of(listener, res, destroy);
+
+   if(res->budget) res->budget->used[res->kind]--;
+   if(res->kind==BUDGET_SURFACES) UNLISTEN(&res->commit);
+   wl_list_remove(&res->link);
+   UNLISTEN(&res->destroy);
+   alloc_free(res);
+}
+
+// every wl_surface of the client counts, subsurfaces and popups included
+static void
+surface_commit_notify(struct wl_listener *listener, void *data)
+{
+   struct budget_resource *res = wl_container_of(listener, res, commit);
+   struct client_budget *budget = res->budget;
+   if(!budget || !g_config->client_budget[BUDGET_COMMITS]) return;
+
+   uint64_t now = stats_now();
+   if(now - budget->window_start >= NS_PER_SEC) {
+      budget->window_start = now;
+      budget->used[BUDGET_COMMITS] = 0;
+   }
+   budget->used[BUDGET_COMMITS]++;
+   budget_check(budget, BUDGET_COMMITS);
+}
+
+static struct budget_resource*
+budget_track(struct wl_resource *resource, struct wl_signal *destroy, enum ClientBudget kind)
+{
+   struct client_budget *budget = get_budget(wl_resource_get_client(resource));
+   if(!budget) return NULL;
+
+   struct budget_resource *res = alloc_calloc(ALLOC_CLIENT, 1, sizeof(struct budget_resource));
+   if(!res) return NULL;
+
+   res->budget = budget;
+   res->kind = kind;
+   wl_list_insert(&budget->resources, &res->link);
+   LISTEN(destroy, &res->destroy, resource_destroy_notify);
+
+   budget->used[kind]++;
+   return res;
+}
+
+//------------------------------------------------------------------------
+void
+budget_new_surface(struct wlr_surface *surface)
+{
+   struct budget_resource *res = budget_track(surface->resource, &surface->events.destroy, BUDGET_SURFACES);
+   if(!res) return;
+
+   LISTEN(&surface->events.commit, &res->commit, surface_commit_notify);
+   budget_check(res->budget, BUDGET_SURFACES);
+}
+
+bool
+budget_new_toplevel(struct wlr_xdg_toplevel *toplevel)
+{
+   struct budget_resource *res = budget_track(toplevel->resource, &toplevel->events.destroy, BUDGET_WINDOWS);
+   return !res || budget_check(res->budget, BUDGET_WINDOWS);
+}
+
+bool
+budget_new_popup(struct wlr_xdg_popup *popup)
+{
+   struct budget_resource *res = budget_track(popup->resource, &popup->events.destroy, BUDGET_POPUPS);
+   return !res || budget_check(res->budget, BUDGET_POPUPS);
+}
+
+void
+budget_report(void (*emit)(const char*, void*), void *data)
+{
+   char line[256];
+   struct client_budget *budget;
+
+   wl_list_for_each(budget, &budgets, link) {
+      int len = snprintf(line, sizeof line, "pid %d:", budget->pid);
+      for(int i=0; i<NBUDGET && len < (int)sizeof line; i++) {
+         if(g_config->client_budget[i])
+            len += snprintf(line + len, sizeof line - len, " %s %d/%d", budget_str[i], budget->used[i], g_config->client_budget[i]);
+         else
+            len += snprintf(line + len, sizeof line - len, " %s %d", budget_str[i], budget->used[i]);
+         if(budget->breaches[i] && len < (int)sizeof line)
+            len += snprintf(line + len, sizeof line - len, " (over %lu times)", budget->breaches[i]);
+      }
+      emit(line, data);
+   }
+}
@@ -1,8 +1,11 @@
 #include <assert.h>
+#include <limits.h>
+#include <signal.h>
 #include <string.h>
 #include <wlr/backend/session.h>
 #include <wlr/types/wlr_cursor.h>
 #include <wlr/types/wlr_layer_shell_v1.h>
+#include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_scene.h>
 #include <wlr/types/wlr_xcursor_manager.h>
 #include <wlr/types/wlr_xdg_shell.h>
@@ -12,6 +15,12 @@
 #include "input.h"
 #include "client.h"
 #include "server.h"
+#include "spatial.h"
+#include "rule.h"
+#include "ipc.h"
+#include "stats.h"
+#include "alloc.h"
+#include "budget.h"
 
 static inline struct wlr_surface*
 get_client_surface(struct simple_client *client)
@@ -33,6 +42,20 @@ sendClientToTag(struct simple_client *client, int tag)
    print_server_info();
 }
 
+void
+forceKillClient(struct simple_client *client)
+{
+   if(!client) return;
+
+   pid_t pid = get_client_pid(client);
+   if(pid<=0 || pid==getpid()) {
+      say(WARNING, "No process to kill for this client");
+      return;
+   }
+   say(INFO, "Killing client process %d", pid);
+   kill(pid, SIGKILL);
+}
+
 void
 toggleClientVisible(struct simple_client *client)
 {
@@ -74,6 +97,41 @@ maximizeClient(struct simple_client *client)
    set_client_geometry(client, false);
 }
 
+void
+setClientFullscreen(struct simple_client *client, bool fullscreen)
+{
+   if(!client || client->type==XWL_UNMANAGED_CLIENT) return;
+
+   struct simple_output *output = client->output;
+   if(client->fullscreen == fullscreen || !output) return;
+
+   if(fullscreen && output->fullscreen_client)
+      setClientFullscreen(output->fullscreen_client, false);
+
+   client->fullscreen = fullscreen;
+   if(client->type==XDG_SHELL_CLIENT)
+      wlr_xdg_toplevel_set_fullscreen(client->xdg_surface->toplevel, fullscreen);
+#if XWAYLAND
+   else
+      wlr_xwayland_surface_set_fullscreen(client->xwl_surface, fullscreen);
+#endif
+
+   if(fullscreen) {
+      client->prev_geom = client->geom;
+      wlr_output_layout_get_box(g_server->output_layout, output->wlr_output, &client->geom);
+      output->fullscreen_client = client;
+   } else {
+      client->geom = client->prev_geom;
+      output->fullscreen_client = NULL;
+   }
+
+   for(int i=0; i<4; i++)
+      wlr_scene_node_set_enabled(&client->border[i]->node, !fullscreen);
+
+   set_client_geometry(client, false);
+   arrange_output(output);
+}
+
 void
 killClient(struct simple_client *client)
 {
@@ -85,6 +143,8 @@ killClient(struct simple_client *client)
       return;
    }
 #endif
+   // a hung client won't answer the close either, find out so it can be force killed
+   ping_client(client);
    wlr_xdg_toplevel_send_close(client->xdg_surface->toplevel);
 }
 
@@ -115,6 +175,33 @@ tileClient(struct simple_client *client, enum Direction direction)
    set_client_geometry(client, false);
 }
 
+void
+focusClientInDirection(struct simple_client *client, enum Direction direction)
+{
+   if(!client) return;
+
+   struct simple_client *target = spatial_client_in_direction(client, direction);
+   if(target)
+      focus_client(target, true);
+}
+
+void
+swapClientInDirection(struct simple_client *client, enum Direction direction)
+{
+   if(!client) return;
+
+   // a hung client would not follow, leave it in place
+   struct simple_client *target = spatial_client_in_direction(client, direction);
+   if(!target || target->unresponsive) return;
+
+   struct wlr_box geom = client->geom;
+   client->geom = target->geom;
+   target->geom = geom;
+
+   set_client_geometry(client, false);
+   set_client_geometry(target, false);
+}
+
 void
 cycleClients(struct simple_output *output){
    say(DEBUG, "cycleClients");
@@ -151,14 +238,118 @@ cycleClients(struct simple_output *output){
    //---
 }
 
+static int
+compare_int(const void *a, const void *b)
+{
+   return *(const int*)a - *(const int*)b;
+}
+
+static int
+sort_unique(int *edges, int n)
+{
+   if(n==0) return 0;
+
+   qsort(edges, n, sizeof(int), compare_int);
+   int j=0;
+   for(int i=1; i<n; i++)
+      if(edges[i] != edges[j]) edges[++j] = edges[i];
+   return j+1;
+}
+
+static void
+add_snap_box(struct snap_edges *snap, struct wlr_box *box)
+{
+   if(snap->n_x+2 > snap->capacity || snap->n_y+2 > snap->capacity) {
+      snap->capacity = snap->capacity ? snap->capacity*2 : 64;
+      snap->x = alloc_realloc(ALLOC_LAYOUT, snap->x, snap->capacity * sizeof(int));
+      snap->y = alloc_realloc(ALLOC_LAYOUT, snap->y, snap->capacity * sizeof(int));
+      if(!snap->x || !snap->y)
+         say(ERROR, "Cannot allocate snap edges");
+   }
+   snap->x[snap->n_x++] = box->x;
+   snap->x[snap->n_x++] = box->x + box->width;
+   snap->y[snap->n_y++] = box->y;
+   snap->y[snap->n_y++] = box->y + box->height;
+}
+
+static void
+collect_snap_edges(struct simple_client *grabbed)
+{
+   struct snap_edges *snap = &g_server->snap;
+   struct simple_output *output;
+   struct simple_client *client;
+   struct wlr_box box;
+   int bw = g_config->border_width;
+
+   snap->n_x = snap->n_y = 0;
+   if(g_config->snap_distance<=0) return;
+
+   wl_list_for_each(output, &g_server->outputs, link) {
+      wlr_output_layout_get_box(g_server->output_layout, output->wlr_output, &box);
+      add_snap_box(snap, &box);
+      add_snap_box(snap, &output->usable_area);
+   }
+
+   wl_list_for_each(client, &g_server->clients, link) {
+      if(client==grabbed || !client->visible || !VISIBLEON(client, grabbed->output)) continue;
+      box.x = client->geom.x - bw;
+      box.y = client->geom.y - bw;
+      box.width = client->geom.width + 2*bw;
+      box.height = client->geom.height + 2*bw;
+      add_snap_box(snap, &box);
+   }
+
+   snap->n_x = sort_unique(snap->x, snap->n_x);
+   snap->n_y = sort_unique(snap->y, snap->n_y);
+}
+
+static int
+nearest_edge(int *edges, int n, int value)
+{
+   // binary search for the first edge >= value, then compare with its neighbour
+   int lo=0, hi=n;
+   while(lo<hi) {
+      int mid = (lo+hi)/2;
+      if(edges[mid] < value) lo = mid+1;
+      else                   hi = mid;
+   }
+
+   int delta = INT_MAX;
+   if(lo<n)             delta = edges[lo] - value;
+   if(lo>0 && value-edges[lo-1] < abs(delta)) delta = edges[lo-1] - value;
+   return delta;
+}
+
+static int
+snap_offset(int *edges, int n, int start, int end)
+{
+   int d_start = nearest_edge(edges, n, start);
+   int d_end = nearest_edge(edges, n, end);
+   int delta = abs(d_start) <= abs(d_end) ? d_start : d_end;
+
+   return abs(delta) <= g_config->snap_distance ? delta : 0;
+}
+
+void
+snap_client_position(struct simple_client *client)
+{
+   struct snap_edges *snap = &g_server->snap;
+   int bw = g_config->border_width;
+
+   if(snap->n_x>0)
+      client->geom.x += snap_offset(snap->x, snap->n_x, client->geom.x - bw, client->geom.x + client->geom.width + bw);
+   if(snap->n_y>0)
+      client->geom.y += snap_offset(snap->y, snap->n_y, client->geom.y - bw, client->geom.y + client->geom.height + bw);
+}
+
 void 
 begin_interactive(struct simple_client *client, enum CursorMode mode, uint32_t edges)
 {
    // this function sets up an interactive move or resize operation
    struct wlr_surface *focused_surface = g_server->seat->pointer_state.focused_surface;
    
-   // do not move/request unfocused clients
-   if(get_client_surface(client) != wlr_surface_get_root_surface(focused_surface)) 
+   // do not move/request unfocused or fullscreen clients
+   if(get_client_surface(client) != wlr_surface_get_root_surface(focused_surface) || client->fullscreen) 
       return;
 
    g_server->grabbed_client = client;
@@ -168,6 +359,7 @@ begin_interactive(struct simple_client *client, enum CursorMode mode, uint32_t e
       //say(DEBUG, "CURSOR_MOVE");
       g_server->grab_x = g_server->cursor->x - client->geom.x;
       g_server->grab_y = g_server->cursor->y - client->geom.y;
+      collect_snap_edges(client);
       wlr_cursor_set_xcursor(g_server->cursor, g_server->cursor_manager, "fleur");
    } else if(mode == CURSOR_RESIZE) {
       //say(DEBUG, "CURSOR_RESIZE");
@@ -342,6 +534,42 @@ get_client_geometry(struct simple_client *client, struct wlr_box *geom)
    }
 }
 
+#if XWAYLAND
+static struct wl_event_source *xwl_configure_idle;
+
+static void
+xwl_flush_configures(void *data)
+{
+   struct simple_client *client;
+   xwl_configure_idle = NULL;
+
+   wl_list_for_each(client, &g_server->clients, link) {
+      if(client->type!=XWL_MANAGED_CLIENT || !client->configure_pending) continue;
+      client->configure_pending = false;
+
+      // a configure request is always answered, otherwise skip geometry the X client already has
+      struct wlr_xwayland_surface *xsurface = client->xwl_surface;
+      if(!client->configure_reply && xsurface->x==client->geom.x && xsurface->y==client->geom.y
+            && xsurface->width==client->geom.width && xsurface->height==client->geom.height)
+         continue;
+      client->configure_reply = false;
+
+      wlr_xwayland_surface_configure(xsurface, 
+         client->geom.x, client->geom.y, client->geom.width, client->geom.height);
+   }
+}
+
+// configures are coalesced, so an interactive resize sends one per event loop iteration
+static void
+xwl_schedule_configure(struct simple_client *client, bool reply)
+{
+   client->configure_pending = true;
+   client->configure_reply |= reply;
+   if(!xwl_configure_idle)
+      xwl_configure_idle = wl_event_loop_add_idle(g_server->event_loop, xwl_flush_configures, NULL);
+}
+#endif
+
 void 
 set_client_geometry(struct simple_client *client, bool interactive) 
 {
@@ -362,8 +590,7 @@ set_client_geometry(struct simple_client *client, bool interactive)
    } else {
       wlr_scene_node_set_position(&client->scene_tree->node, client->geom.x, client->geom.y);
       wlr_scene_node_set_position(&client->scene_surface_tree->node, 0, 0);
-      wlr_xwayland_surface_configure(client->xwl_surface, 
-         client->geom.x, client->geom.y, client->geom.width, client->geom.height);
+      xwl_schedule_configure(client, false);
 #endif
    }
 
@@ -382,6 +609,16 @@ set_client_geometry(struct simple_client *client, bool interactive)
    wlr_scene_rect_set_size(client->border[3], bw, client->geom.height + 2 * bw);
    wlr_scene_node_set_position(&client->border[3]->node, client->geom.width, -bw);
 
+   spatial_update_client(client);
+}
+
+void
+set_client_suspended(struct simple_client *client, bool suspended)
+{
+   if(client->type!=XDG_SHELL_CLIENT || client->suspended==suspended) return;
+
+   client->suspended = suspended;
+   wlr_xdg_toplevel_set_suspended(client->xdg_surface->toplevel, suspended);
 }
 
 void 
@@ -442,19 +679,52 @@ focus_client(struct simple_client *client, bool raise)
       print_server_info();
 }
 
+static void
+place_client_smart(struct simple_client* client, struct wlr_box *bounds)
+{
+   // try a fixed lattice of positions over the usable area and keep the one
+   // overlapping the least; ties go to the position closest to the cursor
+   int bw = g_config->border_width;
+   int step = SPATIAL_CELL_SIZE/2;
+   struct wlr_box box = { 0, 0, client->geom.width + 2*bw, client->geom.height + 2*bw };
+
+   long best_overlap = -1, best_dist = 0;
+   int max_x = MAX(bounds->x, bounds->x + bounds->width - box.width);
+   int max_y = MAX(bounds->y, bounds->y + bounds->height - box.height);
+   for(int y=bounds->y; y<=max_y; y+=step) {
+      for(int x=bounds->x; x<=max_x; x+=step) {
+         box.x = x; box.y = y;
+         long overlap = spatial_overlap_area(client->output, &box, client);
+         long dx = x + box.width/2 - (long)g_server->cursor->x;
+         long dy = y + box.height/2 - (long)g_server->cursor->y;
+         long dist = dx*dx + dy*dy;
+         if(best_overlap<0 || overlap<best_overlap || (overlap==best_overlap && dist<best_dist)) {
+            best_overlap = overlap;
+            best_dist = dist;
+            client->geom.x = x + bw;
+            client->geom.y = y + bw;
+         }
+      }
+   }
+}
+
 void 
-set_initial_geometry(struct simple_client* client) 
+set_initial_geometry(struct simple_client* client, bool placed) 
 {
    if(wlr_box_empty(&client->geom))
       get_client_geometry(client, &client->geom);
 
-   // Set initial coord based on cursor position
-   client->geom.x = g_server->cursor->x;
-   client->geom.y = g_server->cursor->y;
-
-   struct simple_output* output = g_server->cur_output;
+   struct simple_output* output = client->output;
    struct wlr_box bounds = output->usable_area;
 
+   // Set initial coord based on cursor position, or the least crowded spot
+   if(!placed) {
+      client->geom.x = g_server->cursor->x;
+      client->geom.y = g_server->cursor->y;
+      if(g_config->smart_placement)
+         place_client_smart(client, &bounds);
+   }
+
    // check the boundaries
    if(client->geom.x<bounds.x+g_config->border_width) client->geom.x=bounds.x + g_config->border_width;
    if(client->geom.y<bounds.y+g_config->border_width) client->geom.y=bounds.y + g_config->border_width;
@@ -504,9 +774,11 @@ map_notify(struct wl_listener *listener, void *data)
 
    client->output = op;
    client->tag = op->current_tag;
+   client->mapped = true;
    client->visible = true;
    client->fixed = false;
    client->urgent = false;
+   client->suspend_hidden = false;
 
 #if XWAYLAND
    // Handle unmanaged clients first
@@ -533,12 +805,21 @@ map_notify(struct wl_listener *listener, void *data)
    }
 #endif
    
+   bool placed = apply_client_rules(client);
+
    wl_list_insert(&g_server->clients, &client->link);
-   set_initial_geometry(client);
+   set_initial_geometry(client, placed);
 
    wlr_scene_node_reparent(&client->scene_tree->node, g_server->layer_tree[LyrClient]);
 
-   focus_client(client, true);
+   if(client->visible && VISIBLEON(client, client->output)) {
+      focus_client(client, true);
+   } else {
+      wlr_scene_node_set_enabled(&client->scene_tree->node, false);
+      set_client_border_colour(client, UNFOCUSED);
+      set_client_suspended(client, client->suspend_hidden);
+      print_server_info();
+   }
 }
 
 static void 
@@ -553,8 +834,15 @@ unmap_notify(struct wl_listener *listener, void *data)
       g_server->grabbed_client = NULL;
    }
    
+   bool was_fullscreen = client->output && client->output->fullscreen_client == client;
+   if(was_fullscreen)
+      client->output->fullscreen_client = NULL;
+
+   client->mapped = false;
    client->visible = false;
    client->fixed = false;
+   client->fullscreen = false;
+   spatial_remove_client(client);
 
 #if XWAYLAND
    if(client->type==XWL_UNMANAGED_CLIENT){
@@ -566,6 +854,10 @@ unmap_notify(struct wl_listener *listener, void *data)
 
    if(client->scene_tree)
       wlr_scene_node_destroy(&client->scene_tree->node);
+
+   // bring back what the fullscreen client was hiding
+   if(was_fullscreen)
+      arrange_output(client->output);
 }
 
 static void
@@ -578,6 +870,24 @@ commit_notify(struct wl_listener *listener, void *data)
       wlr_xdg_toplevel_set_size(client->xdg_surface->toplevel, 0, 0);
       return;
    }
+
+   surface_stats_commit(&client->stats, client->xdg_surface->surface, client->output);
+}
+
+static void
+configure_notify(struct wl_listener *listener, void *data)
+{
+   struct simple_client *client = wl_container_of(listener, client, configure);
+   struct wlr_xdg_surface_configure *configure = data;
+   surface_stats_configure(&client->stats, configure->serial);
+}
+
+static void
+ack_configure_notify(struct wl_listener *listener, void *data)
+{
+   struct simple_client *client = wl_container_of(listener, client, ack_configure);
+   struct wlr_xdg_surface_configure *configure = data;
+   surface_stats_ack(&client->stats, configure->serial);
 }
 
 static void 
@@ -587,23 +897,81 @@ destroy_notify(struct wl_listener *listener, void *data)
    struct simple_client *client = wl_container_of(listener, client, destroy);
 //   struct simple_output * output = g_server->cur_output;
 
-   wl_list_remove(&client->destroy.link);
+   UNLISTEN(&client->destroy);
+   UNLISTEN(&client->request_fullscreen);
+   UNLISTEN(&client->set_title);
+   UNLISTEN(&client->set_app_id);
    if(client->type==XDG_SHELL_CLIENT){
-      wl_list_remove(&client->map.link);
-      wl_list_remove(&client->unmap.link);
+      UNLISTEN(&client->map);
+      UNLISTEN(&client->unmap);
+      UNLISTEN(&client->commit);
+      UNLISTEN(&client->configure);
+      UNLISTEN(&client->ack_configure);
+      UNLISTEN(&client->ping_timeout);
 #if XWAYLAND
    } else {
-      wl_list_remove(&client->associate.link);
-      wl_list_remove(&client->dissociate.link);
-      wl_list_remove(&client->request_activate.link);
-      wl_list_remove(&client->request_configure.link);
+      UNLISTEN(&client->associate);
+      UNLISTEN(&client->dissociate);
+      UNLISTEN(&client->request_activate);
+      UNLISTEN(&client->request_configure);
+      UNLISTEN(&client->set_hints);
 #endif
    }
-   free(client);
+   alloc_free(client);
 
    //focus_client(get_top_client_from_output(output, false), true);
 }
 
+// only the focused client's title and app id are shown over IPC
+static void
+set_title_notify(struct wl_listener *listener, void *data)
+{
+   say(DEBUG, "set_title_notify");
+   struct simple_client *client = wl_container_of(listener, client, set_title);
+
+   if(client->mapped && client->output && client==get_top_client_from_output(client->output, false))
+      ipc_output_printstatus(client->output);
+}
+
+static void
+set_app_id_notify(struct wl_listener *listener, void *data)
+{
+   say(DEBUG, "set_app_id_notify");
+   struct simple_client *client = wl_container_of(listener, client, set_app_id);
+
+   if(client->mapped && client->output && client==get_top_client_from_output(client->output, false))
+      ipc_output_printstatus(client->output);
+}
+
+static void
+ping_timeout_notify(struct wl_listener *listener, void *data)
+{
+   struct simple_client *client = wl_container_of(listener, client, ping_timeout);
+
+   client->ping_sent = 0;
+   if(client->unresponsive) return;
+
+   say(WARNING, "Client %s (pid %d) is not responding", get_client_appid(client), get_client_pid(client));
+   client->unresponsive = true;
+   print_server_info();
+}
+
+static void
+xdg_request_fullscreen_notify(struct wl_listener *listener, void *data)
+{
+   say(DEBUG, "xdg_request_fullscreen_notify");
+   struct simple_client *client = wl_container_of(listener, client, request_fullscreen);
+   struct wlr_xdg_toplevel *toplevel = client->xdg_surface->toplevel;
+
+   // an unmapped client still expects a configure in reply
+   if(!client->mapped) {
+      if(client->xdg_surface->initialized)
+         wlr_xdg_surface_schedule_configure(client->xdg_surface);
+      return;
+   }
+   setClientFullscreen(client, toplevel->requested.fullscreen);
+}
+
 static void
 popup_commit_notify(struct wl_listener *listener, void *data)
 {
@@ -627,7 +995,7 @@ popup_commit_notify(struct wl_listener *listener, void *data)
    box.y -= (type==LAYER_SHELL_CLIENT ? lsurface->geom.y : client->geom.y);
    wlr_xdg_popup_unconstrain_from_box(popup, &box);
 
-   wl_list_remove(&listener->link);
+   UNLISTEN(listener);
 }
 
 // --- XDG Shell ---------------------------------------------------------
@@ -637,8 +1005,11 @@ xdg_new_toplevel_notify(struct wl_listener *listener, void *data)
    say(DEBUG, "new_xdg_surface_notify");
    struct wlr_xdg_toplevel *xdg_toplevel = data;
 
+   // over budget it is never managed: no client, no scene node, never configured or shown
+   if(!budget_new_toplevel(xdg_toplevel)) return;
+
    // allocate a simple_client for this surface
-   struct simple_client *xdg_client = calloc(1, sizeof(struct simple_client));
+   struct simple_client *xdg_client = alloc_calloc(ALLOC_CLIENT, 1, sizeof(struct simple_client));
    xdg_client->type = XDG_SHELL_CLIENT;
    xdg_client->xdg_surface = xdg_toplevel->base;
 
@@ -646,6 +1017,12 @@ xdg_new_toplevel_notify(struct wl_listener *listener, void *data)
    LISTEN(&xdg_toplevel->base->surface->events.map, &xdg_client->map, map_notify);
    LISTEN(&xdg_toplevel->base->surface->events.unmap, &xdg_client->unmap, unmap_notify);
    LISTEN(&xdg_toplevel->base->surface->events.commit, &xdg_client->commit, commit_notify);
+   LISTEN(&xdg_toplevel->base->events.configure, &xdg_client->configure, configure_notify);
+   LISTEN(&xdg_toplevel->base->events.ack_configure, &xdg_client->ack_configure, ack_configure_notify);
+   LISTEN(&xdg_toplevel->base->events.ping_timeout, &xdg_client->ping_timeout, ping_timeout_notify);
+   LISTEN(&xdg_toplevel->events.request_fullscreen, &xdg_client->request_fullscreen, xdg_request_fullscreen_notify);
+   LISTEN(&xdg_toplevel->events.set_title, &xdg_client->set_title, set_title_notify);
+   LISTEN(&xdg_toplevel->events.set_app_id, &xdg_client->set_app_id, set_app_id_notify);
 }
 
 static struct wl_listener popup_commit_listener;
@@ -656,11 +1033,128 @@ xdg_new_popup_notify(struct wl_listener *listener, void *data)
    //void
    struct wlr_xdg_popup *xdg_popup = data;
 
+   // a popup over budget is never placed in the scene
+   if(!budget_new_popup(xdg_popup)) return;
    LISTEN(&xdg_popup->base->surface->events.commit, &popup_commit_listener, &popup_commit_notify);
 }
 
+//--- Responsiveness -----------------------------------------------------
+// wlroots keeps one outstanding ping per wl_client and reports timeouts, but not
+// replies; a protocol logger sees each pong as it is read, before wlroots handles it
+#define XDG_WM_BASE_PONG_OPCODE 3
+
+static struct wl_event_source *ping_timer;
+static struct wl_protocol_logger *pong_logger;
+
+pid_t
+get_client_pid(struct simple_client *client)
+{
+   pid_t pid = 0;
+#if XWAYLAND
+   if(client->type==XWL_MANAGED_CLIENT || client->type==XWL_UNMANAGED_CLIENT)
+      return client->xwl_surface->pid;
+#endif
+   wl_client_get_credentials(wl_resource_get_client(client->xdg_surface->resource), &pid, NULL, NULL);
+   return pid;
+}
+
+float
+get_client_ping_ms(struct simple_client *client)
+{
+   int n = MIN(client->n_pings, PING_HISTORY);
+   float sum = 0;
+   for(int i=0; i<n; i++)
+      sum += client->ping_ms[i];
+   return n ? sum/n : 0;
+}
+
+static void
+pong_notify(void *data, enum wl_protocol_logger_type type, const struct wl_protocol_logger_message *message)
+{
+   if(type!=WL_PROTOCOL_LOGGER_REQUEST || message->message_opcode!=XDG_WM_BASE_PONG_OPCODE
+         || strcmp(wl_resource_get_class(message->resource), "xdg_wm_base")) return;
+
+   struct wlr_xdg_client *xdg_client = wl_resource_get_user_data(message->resource);
+   if(!xdg_client || message->arguments[0].u != xdg_client->ping_serial) return;
+
+   struct simple_client *client;
+   bool changed = false;
+   uint64_t now = stats_now();
+
+   // every window of the wl_client shares the ping
+   wl_list_for_each(client, &g_server->clients, link) {
+      if(client->type!=XDG_SHELL_CLIENT || !client->ping_sent || client->xdg_surface->client!=xdg_client) continue;
+
+      client->ping_ms[client->n_pings++ % PING_HISTORY] = (now - client->ping_sent)/1e6;
+      client->ping_sent = 0;
+      if(client->unresponsive) {
+         say(INFO, "Client %s is responding again", get_client_appid(client));
+         client->unresponsive = false;
+         changed = true;
+      }
+   }
+
+   if(changed)
+      print_server_info();
+}
+
+void
+ping_client(struct simple_client *client)
+{
+   if(!client || client->type!=XDG_SHELL_CLIENT || !client->mapped || client->ping_sent) return;
+
+   g_server->xdg_shell->ping_timeout = g_config->ping_timeout_ms;
+   wlr_xdg_surface_ping(client->xdg_surface);
+   client->ping_sent = stats_now();
+
+   if(!pong_logger)
+      pong_logger = wl_display_add_protocol_logger(g_server->display, pong_notify, NULL);
+}
+
+static int
+ping_timer_notify(void *data)
+{
+   struct simple_client *client;
+   wl_list_for_each(client, &g_server->clients, link)
+      ping_client(client);
+
+   if(g_config->ping_interval)
+      wl_event_source_timer_update(ping_timer, g_config->ping_interval*1000);
+   return 0;
+}
+
+void
+start_ping_timer()
+{
+   if(!ping_timer)
+      ping_timer = wl_event_loop_add_timer(g_server->event_loop, ping_timer_notify, NULL);
+   wl_event_source_timer_update(ping_timer, g_config->ping_interval*1000);
+}
+
+bool
+force_kill_pid(pid_t pid)
+{
+   struct simple_client *client;
+
+   // only processes owning one of our windows
+   if(pid<=0) return false;
+   wl_list_for_each(client, &g_server->clients, link) {
+      if(get_client_pid(client)!=pid) continue;
+      forceKillClient(client);
+      return true;
+   }
+   return false;
+}
+
 //---- XWayland Shell ----------------------------------------------------
 #if XWAYLAND
+static void
+xwl_commit_notify(struct wl_listener *listener, void *data)
+{
+   struct simple_client *client = wl_container_of(listener, client, commit);
+   surface_stats_commit(&client->stats, client->xwl_surface->surface, client->output);
+}
+
 static void 
 xwl_associate_notify(struct wl_listener *listener, void *data) 
 {
@@ -669,6 +1163,7 @@ xwl_associate_notify(struct wl_listener *listener, void *data)
 
    LISTEN(&xwl_client->xwl_surface->surface->events.map, &xwl_client->map, map_notify);
    LISTEN(&xwl_client->xwl_surface->surface->events.unmap, &xwl_client->unmap, unmap_notify);
+   LISTEN(&xwl_client->xwl_surface->surface->events.commit, &xwl_client->commit, xwl_commit_notify);
 }
 
 static void 
@@ -677,8 +1172,9 @@ xwl_dissociate_notify(struct wl_listener *listener, void *data)
    say(DEBUG, "xwl_dissociate_notify");
    struct simple_client *xwl_client = wl_container_of(listener, xwl_client, dissociate);
 
-   wl_list_remove(&xwl_client->map.link);
-   wl_list_remove(&xwl_client->unmap.link);
+   UNLISTEN(&xwl_client->map);
+   UNLISTEN(&xwl_client->unmap);
+   UNLISTEN(&xwl_client->commit);
 }
 
 static void 
@@ -697,45 +1193,55 @@ xwl_request_configure_notify(struct wl_listener *listener, void *data)
    struct simple_client *client = wl_container_of(listener, client, request_configure);
    struct wlr_xwayland_surface_configure_event *event = data;
 
-   if(!wlr_box_empty(&client->geom)){
-      client->geom.x = event->x;          client->geom.y = event->y;
-      client->geom.width = event->width;  client->geom.height = event->height;
-      set_client_geometry(client, false);
+   // not managed yet: let the window have what it asks for
+   if(!client->mapped || client->type!=XWL_MANAGED_CLIENT || wlr_box_empty(&client->geom)){
+      wlr_xwayland_surface_configure(client->xwl_surface, event->x, event->y, event->width, event->height);
+      if(client->mapped && client->type==XWL_UNMANAGED_CLIENT)
+         wlr_scene_node_set_position(&client->scene_tree->node, event->x, event->y);
+      return;
    }
 
-   wlr_xwayland_surface_configure(client->xwl_surface, event->x, event->y, event->width, event->height);
+   client->geom.x = event->x;          client->geom.y = event->y;
+   client->geom.width = event->width;  client->geom.height = event->height;
+   set_client_geometry(client, false);
+   xwl_schedule_configure(client, true);
 }
 
 static void
 xwl_set_hints_notify(struct wl_listener *listener, void *data)
 {
    say(DEBUG, "xwl_set_hints_notify");
-}
+   struct simple_client *client = wl_container_of(listener, client, set_hints);
+   xcb_icccm_wm_hints_t *hints = client->xwl_surface->hints;
 
-static void
-xwl_set_title_notify(struct wl_listener *listener, void *data)
-{
-   say(DEBUG, "xwl_set_title_notify");
+   if(!client->mapped || client->type!=XWL_MANAGED_CLIENT || !hints) return;
+
+   bool urgent = hints->flags & XCB_ICCCM_WM_HINT_X_URGENCY;
+   if(urgent==client->urgent) return;
+   if(urgent && client==get_top_client_from_output(client->output, false)) return;
+
+   client->urgent = urgent;
+   if(client->xwl_surface->surface != g_server->seat->keyboard_state.focused_surface)
+      set_client_border_colour(client, urgent ? URGENT : UNFOCUSED);
 }
 
 static void
 xwl_request_fullscreen_notify(struct wl_listener *listener, void *data)
 {
    say(DEBUG, "xwl_request_fullscreen_notify");
-}
+   struct simple_client *client = wl_container_of(listener, client, request_fullscreen);
 
-xcb_atom_t
-getatom(xcb_connection_t *xc, const char *name)
-{
-   xcb_atom_t atom = 0;
-   xcb_intern_atom_reply_t *reply;
-   xcb_intern_atom_cookie_t cookie = xcb_intern_atom(xc, 0, strlen(name), name);
-   if ((reply = xcb_intern_atom_reply(xc, cookie, NULL)))
-      atom = reply->atom;
-   free(reply);
-   return atom;
+   if(client->mapped)
+      setClientFullscreen(client, client->xwl_surface->fullscreen);
 }
 
+static const char *netatom_names[NetLast] = {
+   [NetWMWindowTypeDialog]  = "_NET_WM_WINDOW_TYPE_DIALOG",
+   [NetWMWindowTypeSplash]  = "_NET_WM_WINDOW_TYPE_SPLASH",
+   [NetWMWindowTypeToolbar] = "_NET_WM_WINDOW_TYPE_TOOLBAR",
+   [NetWMWindowTypeUtility] = "_NET_WM_WINDOW_TYPE_UTILITY",
+};
+
 //------------------------------------------------------------------------
 void 
 xwl_ready_notify(struct wl_listener *listener, void *data) 
@@ -747,10 +1253,17 @@ xwl_ready_notify(struct wl_listener *listener, void *data)
    if(err)
       say(WARNING, "xcb_connect to X server failed with code %d", err);
 
-   g_server->netatom[NetWMWindowTypeDialog] = getatom(xc, "_NET_WM_WINDOW_TYPE_DIALOG");
-   g_server->netatom[NetWMWindowTypeSplash] = getatom(xc, "_NET_WM_WINDOW_TYPE_SPLASH");
-   g_server->netatom[NetWMWindowTypeToolbar] = getatom(xc, "_NET_WM_WINDOW_TYPE_TOOLBAR");
-   g_server->netatom[NetWMWindowTypeUtility] = getatom(xc, "_NET_WM_WINDOW_TYPE_UTILITY");
+   // Xwayland may have been restarted since the last ready, so atoms are interned
+   // again each time; send all requests first so this costs a single round trip
+   xcb_intern_atom_cookie_t cookies[NetLast];
+   for(int i=0; i<NetLast && !err; i++)
+      cookies[i] = xcb_intern_atom(xc, 0, strlen(netatom_names[i]), netatom_names[i]);
+
+   for(int i=0; i<NetLast && !err; i++) {
+      xcb_intern_atom_reply_t *reply = xcb_intern_atom_reply(xc, cookies[i], NULL);
+      g_server->netatom[i] = reply ? reply->atom : 0;
+      free(reply);
+   }
 
    wlr_xwayland_set_seat(g_server->xwayland, g_server->seat);
    
@@ -772,7 +1285,7 @@ xwl_new_surface_notify(struct wl_listener *listener, void *data)
    struct wlr_xwayland_surface *xsurface = data;
 
    // Create simple_client for this surface 
-   struct simple_client *xwl_client = calloc(1, sizeof(struct simple_client));
+   struct simple_client *xwl_client = alloc_calloc(ALLOC_CLIENT, 1, sizeof(struct simple_client));
    xwl_client->type = xsurface->override_redirect ? XWL_UNMANAGED_CLIENT : XWL_MANAGED_CLIENT;
    xwl_client->xwl_surface = xsurface;
 
@@ -785,7 +1298,8 @@ xwl_new_surface_notify(struct wl_listener *listener, void *data)
    LISTEN(&xsurface->events.request_fullscreen, &xwl_client->request_fullscreen, xwl_request_fullscreen_notify);
 
    LISTEN(&xsurface->events.set_hints, &xwl_client->set_hints, xwl_set_hints_notify);
-   LISTEN(&xsurface->events.set_title, &xwl_client->set_title, xwl_set_title_notify);
+   LISTEN(&xsurface->events.set_title, &xwl_client->set_title, set_title_notify);
+   LISTEN(&xsurface->events.set_class, &xwl_client->set_app_id, set_app_id_notify);
    // More mappings
 }
 #endif
@@ -1,9 +1,54 @@
 #include <ctype.h>
+#include <libgen.h>
+#include <stdalign.h>
+#include <stddef.h>
 #include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
 #include <linux/input-event-codes.h>
+#include <wlr/backend/session.h>
 #include <wlr/types/wlr_keyboard.h>
+#include <wlr/types/wlr_scene.h>
 
 #include "globals.h"
+#include "layer.h"
+#include "client.h"
+#include "server.h"
+#include "input.h"
+#include "rule.h"
+#include "alloc.h"
+#include "worker.h"
+#ifdef BUILTIN_CONFIG
+#include "builtin-config.h"
+#endif
+
+#define ARENA_CHUNK_SIZE   4096
+#define WATCH_DEBOUNCE_MS  200
+
+// bindings live in chunks owned by their config, so a replaced config is freed in one step
+struct config_arena {
+   struct config_arena *next;
+   size_t used, size;
+   alignas(max_align_t) char data[];
+};
+
+enum ConfigChange {
+   CONFIG_COLOURS = 1<<0,
+   CONFIG_BORDER  = 1<<1,
+   CONFIG_KEYMAP  = 1<<2,
+   CONFIG_POINTER = 1<<3,
+   CONFIG_PING    = 1<<4,
+   CONFIG_RESTART = 1<<5,
+   CONFIG_ACCESS  = 1<<6,
+};
+
+static struct {
+   int fd;
+   int wd;
+   char name[64];
+   struct wl_event_source *source;
+   struct wl_event_source *debounce;
+} watch = { .fd = -1, .wd = -1 };
 
 void 
 colour2rgba(const char *color, float dest[static 4]) 
@@ -48,104 +93,247 @@ trim(char *orig)
 }
 
 //------------------------------------------------------------------------
-void 
-set_defaults()
+static void
+set_defaults(struct simple_config *config)
 {
-   g_config->n_tags = 4;
-   g_config->border_width = 2;
-   g_config->sloppy_focus = false;
-   g_config->moveresize_step = 10;
+   config->n_tags = 4;
+   config->border_width = 2;
+   config->sloppy_focus = false;
+   config->smart_placement = false;
+   config->moveresize_step = 10;
+   config->snap_distance = 10;
+   config->xwayland_idle_timeout = 10;
+   config->stall_budget_ms = 0;
+   config->ping_interval = 10;
+   config->ping_timeout_ms = 3000;
+   config->dispatch_budget_us = 4000;
+   config->worker_threads = 2;
+   config->realtime = REALTIME_OFF;
+   config->realtime_priority = 10;
+   for(int i=0; i<NGLOBALS; i++)
+      config->global_access[i] = ACCESS_ON;
+
+   colour2rgba("#111111", config->background_colour);
+   colour2rgba("#0000FF", config->border_colour[FOCUSED]);
+   colour2rgba("#CCCCCC", config->border_colour[UNFOCUSED]);
+   colour2rgba("#FF0000", config->border_colour[URGENT]);
+   colour2rgba("#00FF00", config->border_colour[MARKED]);
+   colour2rgba("#0000FF", config->border_colour[FIXED]);
+   colour2rgba("#FFFFFF", config->border_colour[OUTLINE]);
+
+   config->autostart_script[0] = '\0';
+   config->metrics_socket[0] = '\0';
+   config->spawn_cgroup[0] = '\0';
+   config->privileged_clients[0] = '\0';
+   config->lock_cmd[0] = '\0';
+   config->xkb_layout[0] = '\0';
+   config->xkb_options[0] = '\0';
+}
 
-   colour2rgba("#111111", g_config->background_colour);
-   colour2rgba("#0000FF", g_config->border_colour[FOCUSED]);
-   colour2rgba("#CCCCCC", g_config->border_colour[UNFOCUSED]);
-   colour2rgba("#FF0000", g_config->border_colour[URGENT]);
-   colour2rgba("#00FF00", g_config->border_colour[MARKED]);
-   colour2rgba("#0000FF", g_config->border_colour[FIXED]);
-   colour2rgba("#FFFFFF", g_config->border_colour[OUTLINE]);
+#ifdef BUILTIN_CONFIG
+static struct simple_config*
+builtin_configuration()
+{
+   static struct simple_config config;
+   char rule[256];
+
+   set_defaults(&config);
+   builtin_settings(&config);
+   config.key_bindings = builtin_key_bindings;
+   config.n_key_bindings = N_BUILTIN_KEY_BINDINGS;
+   config.mouse_bindings = builtin_mouse_bindings;
+   config.n_mouse_bindings = N_BUILTIN_MOUSE_BINDINGS;
+
+   // rules still need their patterns compiled
+   if(!(config.rules = rule_set_create())) say(ERROR, "Cannot allocate window rules");
+   for(const char **r = builtin_rules; *r; r++) {
+      strncpy(rule, *r, sizeof rule - 1);
+      rule_set_add(config.rules, rule);
+   }
+   if(!rule_set_compile(config.rules)) say(ERROR, "Cannot allocate window rules");
+   return &config;
+}
+#else
+// parsing runs on a worker for reloads, so running out of memory makes it
+// return NULL rather than exit
+static void*
+arena_alloc(struct simple_config *config, size_t size)
+{
+   size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+   struct config_arena *chunk = config->arena;
+   if(!chunk || chunk->used + size > chunk->size) {
+      size_t chunk_size = MAX(ARENA_CHUNK_SIZE, size);
+      if(!(chunk = alloc_calloc(ALLOC_CONFIG, 1, sizeof(struct config_arena) + chunk_size)))
+         return NULL;
+      chunk->size = chunk_size;
+      chunk->next = config->arena;
+      config->arena = chunk;
+   }
 
-   g_config->autostart_script[0] = '\0';
-   g_config->lock_cmd[0] = '\0';
-   g_config->xkb_layout[0] = '\0';
-   g_config->xkb_options[0] = '\0';
+   void *ptr = chunk->data + chunk->used;
+   chunk->used += size;
+   return ptr;
 }
 
-void
-readConfiguration(char* filename) 
+static void
+free_configuration(struct simple_config *config)
 {
-   say(INFO, "Reading configuration file %s", filename);
-   if(strcmp(g_config->config_file_name, filename))
-      strncpy(g_config->config_file_name, filename, sizeof g_config->config_file_name);
+   if(!config) return;
 
-   set_defaults();
+   rule_set_destroy(config->rules);
+   for(struct config_arena *chunk = config->arena, *next; chunk; chunk = next) {
+      next = chunk->next;
+      alloc_free(chunk);
+   }
+   alloc_free(config);
+}
 
-   wl_list_init(&g_config->key_bindings);
-   wl_list_init(&g_config->mouse_bindings);
+// bindings are collected in a growing array, then copied once into the arena;
+// NULL leaves the array as it was
+static void*
+grow_array(void *array, int n, int *capacity, size_t size)
+{
+   if(n < *capacity) return array;
 
+   int grown = *capacity ? *capacity*2 : 16;
+   if(!(array = alloc_realloc(ALLOC_CONFIG, array, grown * size))) return NULL;
+   *capacity = grown;
+   return array;
+}
+
+// frees the array either way
+static const void*
+arena_copy(struct simple_config *config, void *array, size_t size)
+{
+   void *copy = arena_alloc(config, size);
+   if(copy && size) memcpy(copy, array, size);
+   alloc_free(array);
+   return copy;
+}
+
+// global_<name> = off|on|privileged
+static void
+parse_global_access(struct simple_config *config, const char *name, const char *value)
+{
+   static const char *names[NGLOBALS] = {
+      [GLOBAL_SCREENCOPY] = "screencopy",         [GLOBAL_EXPORT_DMABUF] = "export_dmabuf",
+      [GLOBAL_DATA_CONTROL] = "data_control",     [GLOBAL_GAMMA_CONTROL] = "gamma_control",
+      [GLOBAL_OUTPUT_POWER] = "output_power",     [GLOBAL_IPC] = "ipc",
+   };
+
+   for(int i=0; i<NGLOBALS; i++) {
+      if(strcmp(name, names[i])) continue;
+           if(!strcmp(value, "off"))        config->global_access[i] = ACCESS_OFF;
+      else if(!strcmp(value, "on"))         config->global_access[i] = ACCESS_ON;
+      else if(!strcmp(value, "privileged")) config->global_access[i] = ACCESS_PRIVILEGED;
+      else say(WARNING, "Invalid value '%s' for global_%s", value, name);
+      return;
+   }
+   say(WARNING, "Unknown global '%s'", name);
+}
+
+static struct simple_config*
+parse_configuration(const char *filename)
+{
    FILE *f;
-   if(!(f=fopen(g_config->config_file_name, "r")))
-      say(ERROR, "Error reading file %s", g_config->config_file_name);
+   if(!(f=fopen(filename, "r"))) {
+      say(WARNING, "Error reading file %s", filename);
+      return NULL;
+   }
+
+   struct keymap *key_array = NULL, *grown_keys;
+   struct mousemap *button_array = NULL, *grown_buttons;
+   int key_capacity = 0, button_capacity = 0;
 
-   char buffer[128];
+   struct simple_config *config = alloc_calloc(ALLOC_CONFIG, 1, sizeof(struct simple_config));
+   if(!config || !(config->rules = rule_set_create())) goto fail;
+
+   strncpy(config->config_file_name, filename, sizeof config->config_file_name - 1);
+   set_defaults(config);
+
+   char buffer[256];
    char id[32];
-   char value[128];
+   char value[256];
    char* token;
+   char* saveptr;
    while (fgets(buffer, sizeof buffer, f)){
       if(buffer[0]=='\n' || buffer[0]=='#') continue;
       
-      token = strtok(buffer, "=");
+      token = strtok_r(buffer, "=", &saveptr);
       strncpy(id, token, sizeof id); 
       trim(id);
 
-      token=strtok(NULL, "=");
+      token=strtok_r(NULL, "=", &saveptr);
       strncpy(value, token, sizeof value);
       trim(value);
 
       say(DEBUG, "config id = '%s' / value = '%s'", id, value);
          
-      if(!strcmp(id, "n_tags")) g_config->n_tags=atoi(value);
-
-      if(!strcmp(id, "border_width"))     g_config->border_width = atoi(value);
-      if(!strcmp(id, "tile_gap_width"))   g_config->tile_gap_width = atoi(value);
-      if(!strcmp(id, "moveresize_step"))  g_config->moveresize_step = atoi(value);
-      if(!strcmp(id, "sloppy_focus"))     g_config->sloppy_focus = !strcmp(value, "true") ? true : false; 
-      if(!strcmp(id, "touchpad_tap_click"))  g_config->touchpad_tap_click = !strcmp(value, "true") ? true : false; 
-
-      if(!strcmp(id, "background_colour"))      colour2rgba(value, g_config->background_colour);
-      if(!strcmp(id, "border_colour_focus"))    colour2rgba(value, g_config->border_colour[FOCUSED]);
-      if(!strcmp(id, "border_colour_unfocus"))  colour2rgba(value, g_config->border_colour[UNFOCUSED]);
-      if(!strcmp(id, "border_colour_urgent"))   colour2rgba(value, g_config->border_colour[URGENT]);
-      if(!strcmp(id, "border_colour_marked"))   colour2rgba(value, g_config->border_colour[MARKED]);
-      if(!strcmp(id, "border_colour_fixed"))    colour2rgba(value, g_config->border_colour[FIXED]);
-      if(!strcmp(id, "border_colour_outline"))  colour2rgba(value, g_config->border_colour[OUTLINE]);
-
-      if(!strcmp(id, "lock_cmd"))      strncpy(g_config->lock_cmd, value, sizeof g_config->lock_cmd);
-
-      if(!strcmp(id, "autostart"))     strncpy(g_config->autostart_script, value, sizeof g_config->autostart_script);
-
-      if(!strcmp(id, "xkb_layout"))    strncpy(g_config->xkb_layout, value, sizeof g_config->xkb_layout);
-      if(!strcmp(id, "xkb_options"))   strncpy(g_config->xkb_options, value, sizeof g_config->xkb_options);
+      if(!strcmp(id, "n_tags")) config->n_tags=atoi(value);
+
+      if(!strcmp(id, "border_width"))     config->border_width = atoi(value);
+      if(!strcmp(id, "tile_gap_width"))   config->tile_gap_width = atoi(value);
+      if(!strcmp(id, "moveresize_step"))  config->moveresize_step = atoi(value);
+      if(!strcmp(id, "snap_distance"))    config->snap_distance = atoi(value);
+      if(!strcmp(id, "sloppy_focus"))     config->sloppy_focus = !strcmp(value, "true") ? true : false; 
+      if(!strcmp(id, "smart_placement"))  config->smart_placement = !strcmp(value, "true") ? true : false; 
+      if(!strcmp(id, "touchpad_tap_click"))  config->touchpad_tap_click = !strcmp(value, "true") ? true : false; 
+      if(!strcmp(id, "xwayland_idle_timeout")) config->xwayland_idle_timeout = MAX(0, atoi(value));
+      if(!strcmp(id, "stall_budget_ms"))  config->stall_budget_ms = MAX(0, atoi(value));
+      if(!strcmp(id, "ping_interval"))    config->ping_interval = MAX(0, atoi(value));
+      if(!strcmp(id, "ping_timeout_ms"))  config->ping_timeout_ms = MAX(100, atoi(value));
+      if(!strcmp(id, "client_max_surfaces"))  config->client_budget[BUDGET_SURFACES] = MAX(0, atoi(value));
+      if(!strcmp(id, "client_max_windows"))   config->client_budget[BUDGET_WINDOWS] = MAX(0, atoi(value));
+      if(!strcmp(id, "client_max_popups"))    config->client_budget[BUDGET_POPUPS] = MAX(0, atoi(value));
+      if(!strcmp(id, "client_max_commits"))   config->client_budget[BUDGET_COMMITS] = MAX(0, atoi(value));
+      if(!strcmp(id, "client_budget_disconnect")) config->client_budget_disconnect = !strcmp(value, "true") ? true : false;
+      if(!strcmp(id, "worker_threads"))   config->worker_threads = MAX(0, atoi(value));
+      if(!strcmp(id, "dispatch_budget_us")) config->dispatch_budget_us = MAX(0, atoi(value));
+      if(!strcmp(id, "watch_config"))     config->watch_config = !strcmp(value, "true") ? true : false; 
+      if(!strcmp(id, "realtime"))         config->realtime = !strcmp(value, "rr") ? REALTIME_RR : !strcmp(value, "fifo") ? REALTIME_FIFO : REALTIME_OFF;
+      if(!strcmp(id, "realtime_priority")) config->realtime_priority = MIN(99, MAX(1, atoi(value)));
+
+      if(!strcmp(id, "background_colour"))      colour2rgba(value, config->background_colour);
+      if(!strcmp(id, "border_colour_focus"))    colour2rgba(value, config->border_colour[FOCUSED]);
+      if(!strcmp(id, "border_colour_unfocus"))  colour2rgba(value, config->border_colour[UNFOCUSED]);
+      if(!strcmp(id, "border_colour_urgent"))   colour2rgba(value, config->border_colour[URGENT]);
+      if(!strcmp(id, "border_colour_marked"))   colour2rgba(value, config->border_colour[MARKED]);
+      if(!strcmp(id, "border_colour_fixed"))    colour2rgba(value, config->border_colour[FIXED]);
+      if(!strcmp(id, "border_colour_outline"))  colour2rgba(value, config->border_colour[OUTLINE]);
+
+      if(!strcmp(id, "lock_cmd"))      strncpy(config->lock_cmd, value, sizeof config->lock_cmd);
+
+      if(!strcmp(id, "autostart"))     strncpy(config->autostart_script, value, sizeof config->autostart_script);
+      if(!strcmp(id, "metrics_socket")) strncpy(config->metrics_socket, value, sizeof config->metrics_socket);
+      if(!strcmp(id, "spawn_cgroup"))  strncpy(config->spawn_cgroup, value, sizeof config->spawn_cgroup - 1);
+
+      if(!strncmp(id, "global_", 7))   parse_global_access(config, id+7, value);
+      if(!strcmp(id, "privileged_clients")) strncpy(config->privileged_clients, value, sizeof config->privileged_clients - 1);
+
+      if(!strcmp(id, "xkb_layout"))    strncpy(config->xkb_layout, value, sizeof config->xkb_layout);
+      if(!strcmp(id, "xkb_options"))   strncpy(config->xkb_options, value, sizeof config->xkb_options);
 
       if(!strcmp(id, "KEY")){
          char binding[32];
-         token = strtok(value, " ");
+         token = strtok_r(value, " ", &saveptr);
          strncpy(binding, token, sizeof binding);
          trim(binding);
          
          char function[32];
-         token = strtok(NULL, " ");
+         token = strtok_r(NULL, " ", &saveptr);
          strncpy(function, token, sizeof function);
          trim(function);
 
          char args[64];
-         token = strtok(NULL, "");
+         token = strtok_r(NULL, "", &saveptr);
          strncpy(args, token, sizeof args);
          trim(args);
 
          uint32_t mod = 0;
          xkb_keysym_t keysym;
          char keys[32];
-         token = strtok(binding, "+");
+         token = strtok_r(binding, "+", &saveptr);
          strncpy(keys, token, sizeof keys);
          bool do_continue = true;
          while(do_continue){
@@ -157,7 +345,7 @@ readConfiguration(char* filename)
                keysym = xkb_keysym_from_name(keys, XKB_KEYSYM_NO_FLAGS);
                do_continue = false;
             }
-            token = strtok(NULL, "+");
+            token = strtok_r(NULL, "+", &saveptr);
             if(token) strncpy(keys, token, sizeof keys);
          }
 
@@ -168,35 +356,39 @@ readConfiguration(char* filename)
          else if(!strcmp(function, "SPAWN"))    this_fn = SPAWN;
          else if(!strcmp(function, "CLIENT"))   this_fn = CLIENT;
          
-         struct keymap *keybind = calloc(1, sizeof(struct keymap));
+         if(!(grown_keys = grow_array(key_array, config->n_key_bindings, &key_capacity, sizeof(struct keymap))))
+            goto fail;
+         key_array = grown_keys;
+         struct keymap *keybind = &key_array[config->n_key_bindings++];
          keybind->mask = mod;
          keybind->keysym = keysym;
          keybind->keyfn = this_fn;
          strncpy(keybind->argument, args, sizeof keybind->argument);
-
-         wl_list_insert(&g_config->key_bindings, &keybind->link);
       }
 
+      if(!strcmp(id, "RULE"))
+         rule_set_add(config->rules, value);
+
       if(!strcmp(id, "MOUSE")){
          char binding[32];
-         token = strtok(value, " ");
+         token = strtok_r(value, " ", &saveptr);
          strncpy(binding, token, sizeof binding);
          trim(binding);
          
          char context[32];
-         token = strtok(NULL, " ");
+         token = strtok_r(NULL, " ", &saveptr);
          strncpy(context, token, sizeof context);
          trim(context);
 
          char args[64];
-         token = strtok(NULL, "");
+         token = strtok_r(NULL, "", &saveptr);
          strncpy(args, token, sizeof args);
          trim(args);
 
          unsigned int mod = 0;
          unsigned int button;
          char button_char[32];
-         token = strtok(binding, "+");
+         token = strtok_r(binding, "+", &saveptr);
          strncpy(button_char, token, sizeof button_char);
          bool do_continue = true;
          while(do_continue) {
@@ -212,7 +404,7 @@ readConfiguration(char* filename)
                do_continue = false;
             }
 
-            token = strtok(NULL, "+");
+            token = strtok_r(NULL, "+", &saveptr);
             if(token)   strncpy(button_char, token, sizeof button_char);
          }
 
@@ -220,22 +412,273 @@ readConfiguration(char* filename)
               if(!strcmp(context, "ROOT"))   this_context = CONTEXT_ROOT;
          else if(!strcmp(context, "CLIENT")) this_context = CONTEXT_CLIENT;
 
-         struct mousemap *mousebind = calloc(1, sizeof(struct mousemap));
+         if(!(grown_buttons = grow_array(button_array, config->n_mouse_bindings, &button_capacity, sizeof(struct mousemap))))
+            goto fail;
+         button_array = grown_buttons;
+         struct mousemap *mousebind = &button_array[config->n_mouse_bindings++];
          mousebind->mask = mod;
          mousebind->button = button;
          mousebind->context = this_context;
          strncpy(mousebind->argument, args, sizeof mousebind->argument);
-
-         wl_list_insert(&g_config->mouse_bindings, &mousebind->link);
       }
    }
    fclose(f);
+
+   config->key_bindings = arena_copy(config, key_array, config->n_key_bindings * sizeof(struct keymap));
+   config->mouse_bindings = arena_copy(config, button_array, config->n_mouse_bindings * sizeof(struct mousemap));
+   if(config->key_bindings && config->mouse_bindings && rule_set_compile(config->rules)) return config;
+
+   say(WARNING, "Cannot allocate configuration");
+   free_configuration(config);
+   return NULL;
+
+fail:
+   say(WARNING, "Cannot allocate configuration");
+   fclose(f);
+   alloc_free(key_array);
+   alloc_free(button_array);
+   free_configuration(config);
+   return NULL;
+}
+
+//------------------------------------------------------------------------
+static unsigned int
+diff_configuration(struct simple_config *old, struct simple_config *new)
+{
+   unsigned int changes = 0;
+
+   if(memcmp(old->background_colour, new->background_colour, sizeof old->background_colour)
+         || memcmp(old->border_colour, new->border_colour, sizeof old->border_colour))
+      changes |= CONFIG_COLOURS;
+   if(old->border_width != new->border_width)
+      changes |= CONFIG_BORDER;
+   if(strcmp(old->xkb_layout, new->xkb_layout) || strcmp(old->xkb_options, new->xkb_options))
+      changes |= CONFIG_KEYMAP;
+   if(old->touchpad_tap_click != new->touchpad_tap_click)
+      changes |= CONFIG_POINTER;
+   if(old->ping_interval != new->ping_interval || old->ping_timeout_ms != new->ping_timeout_ms)
+      changes |= CONFIG_PING;
+   if(strcmp(old->privileged_clients, new->privileged_clients))
+      changes |= CONFIG_ACCESS;
+   // switching a global on or off needs a restart, moving it between everyone
+   // and the privileged clients does not
+   for(int i=0; i<NGLOBALS; i++) {
+      if((old->global_access[i]==ACCESS_OFF) != (new->global_access[i]==ACCESS_OFF))
+         changes |= CONFIG_RESTART;
+      else if(old->global_access[i] != new->global_access[i])
+         changes |= CONFIG_ACCESS;
+   }
+   if(old->n_tags != new->n_tags || old->xwayland_idle_timeout != new->xwayland_idle_timeout
+         || old->stall_budget_ms != new->stall_budget_ms || strcmp(old->metrics_socket, new->metrics_socket)
+         || strcmp(old->spawn_cgroup, new->spawn_cgroup) || old->realtime != new->realtime
+         || old->worker_threads != new->worker_threads
+         || old->realtime_priority != new->realtime_priority)
+      changes |= CONFIG_RESTART;
+
+   return changes;
 }
 
+// settings only read at startup keep their running values until a restart, so
+// the live config never disagrees with what was set up from it
+static void
+keep_restart_settings(struct simple_config *old, struct simple_config *new)
+{
+   new->n_tags = old->n_tags;
+   new->xwayland_idle_timeout = old->xwayland_idle_timeout;
+   new->stall_budget_ms = old->stall_budget_ms;
+   new->realtime = old->realtime;
+   new->realtime_priority = old->realtime_priority;
+   new->worker_threads = old->worker_threads;
+   memcpy(new->metrics_socket, old->metrics_socket, sizeof new->metrics_socket);
+   memcpy(new->spawn_cgroup, old->spawn_cgroup, sizeof new->spawn_cgroup);
+
+   // a global that was not created stays off, one that was cannot be switched off
+   for(int i=0; i<NGLOBALS; i++)
+      if((old->global_access[i]==ACCESS_OFF) != (new->global_access[i]==ACCESS_OFF))
+         new->global_access[i] = old->global_access[i];
+}
+
+static void
+apply_configuration(unsigned int changes)
+{
+   struct simple_client *client;
+   struct simple_output *output;
+
+   if(changes & CONFIG_BORDER) {
+      wl_list_for_each(client, &g_server->clients, link)
+         if(client->mapped && client->type!=XWL_UNMANAGED_CLIENT) set_client_geometry(client, false);
+   }
+   if(changes & CONFIG_COLOURS)
+      wlr_scene_rect_set_color(g_server->root_bg, g_config->background_colour);
+   // arranging recolours the borders
+   if(changes & (CONFIG_COLOURS | CONFIG_BORDER)) {
+      wl_list_for_each(output, &g_server->outputs, link)
+         arrange_output(output);
+   }
+
+   if(changes & (CONFIG_KEYMAP | CONFIG_POINTER))
+      update_input_devices(changes & CONFIG_KEYMAP, changes & CONFIG_POINTER);
+   if(changes & CONFIG_PING)
+      start_ping_timer();
+   if(changes & CONFIG_ACCESS)
+      global_filter_reset();
+   if(changes & CONFIG_RESTART)
+      say(WARNING, "Some configuration changes take effect after a restart");
+}
+
+#endif
+
+void
+readConfiguration(char* filename) 
+{
+#ifdef BUILTIN_CONFIG
+   say(INFO, "Using the built-in configuration");
+   g_config = builtin_configuration();
+#else
+   say(INFO, "Reading configuration file %s", filename);
+
+   if(!(g_config = parse_configuration(filename)))
+      say(ERROR, "Error reading file %s", filename);
+#endif
+}
+
+#ifndef BUILTIN_CONFIG
+// the file is parsed on a worker; one reload at a time, a request meanwhile
+// reloads again once it is done
+struct reload_job {
+   char filename[64];
+   struct simple_config *config;
+};
+
+static bool reload_running, reload_again;
+
+static void
+reload_run(void *data)
+{
+   struct reload_job *job = data;
+   job->config = parse_configuration(job->filename);
+}
+
+static void
+reload_done(void *data)
+{
+   struct reload_job *job = data;
+   struct simple_config *config = job->config;
+   alloc_free(job);
+   reload_running = false;
+
+   // the live config is only replaced once the new one parsed completely
+   if(!config) {
+      say(WARNING, "Keeping the current configuration");
+   } else {
+      struct simple_config *old = g_config;
+      unsigned int changes = diff_configuration(old, config);
+      keep_restart_settings(old, config);
+      g_config = config;
+      free_configuration(old);
+
+      apply_configuration(changes);
+      config_watch_update();
+   }
+
+   if(reload_again) {
+      reload_again = false;
+      reloadConfiguration();
+   }
+}
+
+static void
+reload_cancel(void *data)
+{
+   struct reload_job *job = data;
+   free_configuration(job->config);
+   alloc_free(job);
+}
+#endif
+
 void
 reloadConfiguration() {
-   if(g_config->config_file_name[0]=='\0')
-      say(ERROR, "config file %s could no longer be found!", g_config->config_file_name);
+#ifdef BUILTIN_CONFIG
+   say(INFO, "The built-in configuration cannot be reloaded");
+#else
+   if(reload_running) {
+      reload_again = true;
+      return;
+   }
+   say(INFO, "Reloading configuration file %s", g_config->config_file_name);
+
+   struct reload_job *job = alloc_calloc(ALLOC_CONFIG, 1, sizeof(struct reload_job));
+   if(!job) return;
+   strncpy(job->filename, g_config->config_file_name, sizeof job->filename - 1);
+
+   reload_running = true;
+   worker_submit(reload_run, reload_done, reload_cancel, job);
+#endif
+}
+
+//------------------------------------------------------------------------
+static int
+watch_debounce_notify(void *data)
+{
+   reloadConfiguration();
+   return 0;
+}
+
+static int
+watch_notify(int fd, uint32_t mask, void *data)
+{
+   char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+   bool changed = false;
+   ssize_t len;
+
+   // editors replace the file rather than rewrite it, so the directory is watched
+   while((len = read(fd, buffer, sizeof buffer)) > 0) {
+      for(char *p = buffer; p < buffer + len; ) {
+         struct inotify_event *event = (struct inotify_event*)p;
+         if(event->len && !strcmp(event->name, watch.name)) changed = true;
+         p += sizeof(struct inotify_event) + event->len;
+      }
+   }
+
+   // a save often arrives as several events, reload once they settle
+   if(changed)
+      wl_event_source_timer_update(watch.debounce, WATCH_DEBOUNCE_MS);
+   return 0;
+}
+
+void
+config_watch_finish()
+{
+   if(watch.source)     wl_event_source_remove(watch.source);
+   if(watch.debounce)   wl_event_source_remove(watch.debounce);
+   if(watch.fd>=0)      close(watch.fd);
+   watch.source = watch.debounce = NULL;
+   watch.fd = watch.wd = -1;
+}
+
+void
+config_watch_update()
+{
+   if(!g_config->watch_config) {
+      config_watch_finish();
+      return;
+   }
+   if(watch.fd>=0) return;
+
+   char dir[64], name[64];
+   strncpy(dir, g_config->config_file_name, sizeof dir);
+   strncpy(name, g_config->config_file_name, sizeof name);
+   strncpy(watch.name, basename(name), sizeof watch.name - 1);
+
+   if((watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0
+         || (watch.wd = inotify_add_watch(watch.fd, dirname(dir), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE)) < 0) {
+      say(WARNING, "Cannot watch configuration file %s", g_config->config_file_name);
+      config_watch_finish();
+      return;
+   }
 
-   readConfiguration(g_config->config_file_name);
+   struct wl_event_loop *loop = wl_display_get_event_loop(g_server->display);
+   watch.source = wl_event_loop_add_fd(loop, watch.fd, WL_EVENT_READABLE, watch_notify, NULL);
+   watch.debounce = wl_event_loop_add_timer(loop, watch_debounce_notify, NULL);
+   say(INFO, "Watching configuration file %s", g_config->config_file_name);
 }
@@ -19,6 +19,7 @@
 #include "client.h"
 #include "action.h"
 #include "input.h"
+#include "worker.h"
 
 //--- Input functions ----------------------------------------------------
 void 
@@ -75,6 +76,7 @@ kb_key_notify(struct wl_listener *listener, void *data)
 {
    struct simple_input *keyboard = wl_container_of(listener, keyboard, kb_key);
    struct wlr_keyboard_key_event *event = data;
+   g_server->counters.key_events++;
 
    uint32_t keycode = event->keycode + 8;
    const xkb_keysym_t *syms;
@@ -90,8 +92,8 @@ kb_key_notify(struct wl_listener *listener, void *data)
 
    if(event->state == WL_KEYBOARD_KEY_STATE_PRESSED) {
       for(int i=0; i<nsyms; i++){
-         struct keymap *keymap;
-         wl_list_for_each(keymap, &g_config->key_bindings, link) {
+         for(int j=0; j<g_config->n_key_bindings; j++) {
+            const struct keymap *keymap = &g_config->key_bindings[j];
             if (modifiers ^ keymap->mask) continue;
 
             if (syms[i] == keymap->keysym){
@@ -128,6 +130,7 @@ process_cursor_move(uint32_t time)
 
    client->geom.x = g_server->cursor->x - g_server->grab_x;
    client->geom.y = g_server->cursor->y - g_server->grab_y;
+   snap_client_position(client);
 
    set_client_geometry(client, true);
 }
@@ -234,6 +237,7 @@ cursor_motion_notify(struct wl_listener *listener, void *data)
 {
    //say(DEBUG, "cursor_motion_notify");
    struct wlr_pointer_motion_event *event = data;
+   g_server->counters.pointer_events++;
 
    wlr_cursor_move(g_server->cursor, &event->pointer->base, event->delta_x, event->delta_y);
    process_cursor_motion(event->time_msec);
@@ -244,6 +248,7 @@ cursor_motion_abs_notify(struct wl_listener *listener, void *data)
 {
   // say(DEBUG, "cursor_motion_abs_notify");
    struct wlr_pointer_motion_absolute_event *event = data;
+   g_server->counters.pointer_events++;
 
    wlr_cursor_warp_absolute(g_server->cursor, &event->pointer->base, event->x, event->y);
    process_cursor_motion(event->time_msec);
@@ -254,6 +259,7 @@ cursor_button_notify(struct wl_listener *listener, void *data)
 {
    say(DEBUG, "cursor_button_notify");
    struct wlr_pointer_button_event *event = data;
+   g_server->counters.pointer_events++;
 
    wlr_idle_notifier_v1_notify_activity(g_server->idle_notifier, g_server->seat);
 
@@ -264,7 +270,7 @@ cursor_button_notify(struct wl_listener *listener, void *data)
    struct simple_client *client = NULL;
    int ctype = get_client_at(g_server->cursor->x, g_server->cursor->y, &client, &surface, &sx, &sy);
 
-   struct mousemap *mousemap;
+   const struct mousemap *mousemap;
    switch (event->state) {
       case WLR_BUTTON_RELEASED:
          // button release
@@ -282,7 +288,9 @@ cursor_button_notify(struct wl_listener *listener, void *data)
          // press on desktop
          if(!client && ctype==-1) {
             say(DEBUG, "press on desktop");
-            wl_list_for_each(mousemap, &g_config->mouse_bindings, link) {
+            // later bindings take precedence
+            for(int i=g_config->n_mouse_bindings-1; i>=0; i--) {
+               mousemap = &g_config->mouse_bindings[i];
                if(modifiers ^ mousemap->mask) continue;
 
                if(mousemap->context==CONTEXT_ROOT && event->button == mousemap->button){
@@ -293,7 +301,9 @@ cursor_button_notify(struct wl_listener *listener, void *data)
          } else if(ctype!=LAYER_SHELL_CLIENT) { //press on client
             focus_client(client, true);
             uint32_t resize_edges = get_resize_edges(client, g_server->cursor->x, g_server->cursor->y);
-            wl_list_for_each(mousemap, &g_config->mouse_bindings, link) {
+            // later bindings take precedence
+            for(int i=g_config->n_mouse_bindings-1; i>=0; i--) {
+               mousemap = &g_config->mouse_bindings[i];
                if(modifiers ^ mousemap->mask) continue;
 
                if(mousemap->context==CONTEXT_CLIENT && event->button == mousemap->button){
@@ -317,6 +327,7 @@ cursor_axis_notify(struct wl_listener *listener, void *data)
 {
    //say(DEBUG, "cursor_axis_notify");
    struct wlr_pointer_axis_event *event = data;
+   g_server->counters.pointer_events++;
 
    wlr_idle_notifier_v1_notify_activity(g_server->idle_notifier, g_server->seat);
    wlr_seat_pointer_notify_axis(g_server->seat, event->time_msec, event->orientation, event->delta, event->delta_discrete, event->source, event->relative_direction);
@@ -395,14 +406,119 @@ input_destroy_notify(struct wl_listener *listener, void *data)
    say(DEBUG, "input_destroy_notify");
    struct simple_input *input = wl_container_of(listener, input, destroy);
    if (input->type==INPUT_KEYBOARD) {
-      wl_list_remove(&input->kb_modifiers.link);
-      wl_list_remove(&input->kb_key.link);
+      UNLISTEN(&input->kb_modifiers);
+      UNLISTEN(&input->kb_key);
    }
-   wl_list_remove(&input->destroy.link);
+   UNLISTEN(&input->destroy);
    wl_list_remove(&input->link);
    free(input);
 }
 
+//--- Keymap -------------------------------------------------------------
+// One keymap for the configured layout is shared by all keyboards. It is
+// compiled on a worker; a keyboard that shows up before that is done compiles
+// it itself, and a compile overtaken by a newer one is thrown away.
+struct keymap_job {
+   char layout[32];
+   char options[32];
+   unsigned int generation;
+   struct xkb_keymap *keymap;
+};
+
+static struct xkb_keymap *current_keymap;
+static unsigned int keymap_generation;
+
+// any thread: an xkb_context must not be shared, so each compile has its own
+static struct xkb_keymap*
+compile_keymap(const char *layout, const char *options)
+{
+   struct xkb_rule_names rules = { 0 };
+   if(layout[0] != '\0')  rules.layout = layout;
+   if(options[0] != '\0') rules.options = options;
+
+   struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+   if(!context) return NULL;
+   struct xkb_keymap *keymap = xkb_map_new_from_names(context, &rules, XKB_KEYMAP_COMPILE_NO_FLAGS);
+   xkb_context_unref(context);
+   return keymap;
+}
+
+static void
+set_current_keymap(struct xkb_keymap *keymap)
+{
+   if(!keymap) {
+      say(WARNING, "Cannot compile keymap for layout '%s' options '%s'", g_config->xkb_layout, g_config->xkb_options);
+      return;
+   }
+   if(current_keymap) xkb_keymap_unref(current_keymap);
+   current_keymap = keymap;
+}
+
+static void
+keymap_run(void *data)
+{
+   struct keymap_job *job = data;
+   job->keymap = compile_keymap(job->layout, job->options);
+}
+
+static void
+keymap_done(void *data)
+{
+   struct keymap_job *job = data;
+   struct simple_input *input;
+
+   if(job->generation != keymap_generation) {
+      if(job->keymap) xkb_keymap_unref(job->keymap);
+   } else {
+      set_current_keymap(job->keymap);
+      wl_list_for_each(input, &g_server->inputs, link)
+         if(input->type==INPUT_KEYBOARD && current_keymap) wlr_keyboard_set_keymap(input->keyboard, current_keymap);
+   }
+   free(job);
+}
+
+static void
+keymap_cancel(void *data)
+{
+   struct keymap_job *job = data;
+   if(job->keymap) xkb_keymap_unref(job->keymap);
+   free(job);
+}
+
+static void
+compile_keymap_async()
+{
+   struct keymap_job *job = calloc(1, sizeof(struct keymap_job));
+   if(!job) return;
+
+   strncpy(job->layout, g_config->xkb_layout, sizeof job->layout - 1);
+   strncpy(job->options, g_config->xkb_options, sizeof job->options - 1);
+   job->generation = ++keymap_generation;
+   worker_submit(keymap_run, keymap_done, keymap_cancel, job);
+}
+
+static void
+set_keyboard_keymap(struct wlr_keyboard *kb)
+{
+   if(!current_keymap) {
+      keymap_generation++;
+      set_current_keymap(compile_keymap(g_config->xkb_layout, g_config->xkb_options));
+   }
+   if(current_keymap) wlr_keyboard_set_keymap(kb, current_keymap);
+}
+
+static void
+set_pointer_config(struct wlr_input_device *device)
+{
+   if(!wlr_input_device_is_libinput(device)) return;
+
+   struct libinput_device *libinput_device = wlr_libinput_get_device_handle(device);
+   if(libinput_device_config_tap_get_finger_count(libinput_device) > 0) {
+      // touchpad - tap click
+      libinput_device_config_tap_set_enabled(libinput_device, g_config->touchpad_tap_click);
+   }
+}
+
 static void 
 new_input_notify(struct wl_listener *listener, void *data) 
 {
@@ -417,13 +533,7 @@ new_input_notify(struct wl_listener *listener, void *data)
       input->type = INPUT_POINTER;
       wlr_cursor_attach_input_device(g_server->cursor, input->device);
 
-      if(wlr_input_device_is_libinput(device)){
-         struct libinput_device *libinput_device = wlr_libinput_get_device_handle(device);
-         if(libinput_device_config_tap_get_finger_count(libinput_device) > 0 && g_config->touchpad_tap_click) {
-            // touchpad - enable tap click
-            libinput_device_config_tap_set_enabled(libinput_device, true);
-         }
-      }
+      set_pointer_config(device);
 
    } else if (device->type == WLR_INPUT_DEVICE_KEYBOARD) {
       say(DEBUG, "New Input: KEYBOARD");
@@ -431,19 +541,7 @@ new_input_notify(struct wl_listener *listener, void *data)
       struct wlr_keyboard *kb = wlr_keyboard_from_input_device(device);
       input->keyboard = kb;
 
-      struct xkb_rule_names rules = { 0 };
-      if(g_config->xkb_layout[0] != '\0')
-         rules.layout = g_config->xkb_layout;
-      if(g_config->xkb_options[0] != '\0')
-         rules.options = g_config->xkb_options;
-
-      struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-      struct xkb_keymap *keymap = xkb_map_new_from_names(context, &rules, 
-            XKB_KEYMAP_COMPILE_NO_FLAGS);
-
-      wlr_keyboard_set_keymap(kb, keymap);
-      xkb_keymap_unref(keymap);
-      xkb_context_unref(context);
+      set_keyboard_keymap(kb);
       wlr_keyboard_set_repeat_info(kb, 25, 600);
 
       LISTEN(&kb->events.modifiers, &input->kb_modifiers, kb_modifiers_notify);
@@ -479,6 +577,8 @@ void
 input_init()
 {
    wl_list_init(&g_server->inputs);
+   // ready by the time the backend reports the keyboards, with luck
+   compile_keymap_async();
    LISTEN(&g_server->backend->events.new_input, &g_server->new_input, new_input_notify);
 
    LISTEN(&g_server->seat->events.request_set_cursor, &g_server->request_cursor, request_cursor_notify);
@@ -508,3 +608,14 @@ input_init()
    wlr_input_method_manager_v2_create(g_server->display);
    wlr_text_input_manager_v3_create(g_server->display);
 }
+
+void
+update_input_devices(bool keymap, bool pointer)
+{
+   struct simple_input *input;
+   if(keymap) compile_keymap_async();
+   if(!pointer) return;
+
+   wl_list_for_each(input, &g_server->inputs, link)
+      if(input->type==INPUT_POINTER) set_pointer_config(input->device);
+}
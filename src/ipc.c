@@ -1,4 +1,7 @@
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
 #include <wlr/backend/session.h>
 #include <wlr/types/wlr_cursor.h>
 
@@ -9,6 +12,8 @@
 #include "server.h"
 #include "action.h"
 #include "ipc.h"
+#include "trace.h"
+#include "alloc.h"
 
 static void ipc_manager_release(struct wl_client *, struct wl_resource *);
 static void ipc_manager_get_output(struct wl_client *, struct wl_resource *, uint32_t, struct wl_resource *);
@@ -19,16 +24,21 @@ static void ipc_output_release(struct wl_client *, struct wl_resource *);
 static void ipc_output_set_client_tags(struct wl_client *, struct wl_resource *, uint32_t, uint32_t);
 static void ipc_output_set_tags(struct wl_client *, struct wl_resource *, uint32_t, uint32_t);
 
+static void traced_get_output(struct wl_client *, struct wl_resource *, uint32_t, struct wl_resource *);
+static void traced_send_action(struct wl_client *, struct wl_resource *, const char*);
+static void traced_set_client_tags(struct wl_client *, struct wl_resource *, uint32_t, uint32_t);
+static void traced_set_tags(struct wl_client *, struct wl_resource *, uint32_t, uint32_t);
+
 static struct zdwl_ipc_manager_v2_interface ipc_manager_implementation = {
    .release = ipc_manager_release,
-   .get_output = ipc_manager_get_output,
-   .send_action = ipc_manager_send_action
+   .get_output = traced_get_output,
+   .send_action = traced_send_action
 };
 
 static struct zdwl_ipc_output_v2_interface ipc_output_implementation = {
    .release = ipc_output_release,
-   .set_tags = ipc_output_set_tags,
-   .set_client_tags = ipc_output_set_client_tags,
+   .set_tags = traced_set_tags,
+   .set_client_tags = traced_set_client_tags,
 };
 
 //--- Public functions ---------------------------------------------------
@@ -52,12 +62,81 @@ ipc_manager_bind(struct wl_client *client, void *data, uint32_t version, uint32_
 	zdwl_ipc_manager_v2_send_tags(manager_resource, g_config->n_tags);
 }
 
+// Status is sent at most once per event loop iteration, or earlier on an output
+// frame. A watcher that is not reading its socket is skipped until the retry timer,
+// and then gets only the newest state.
+#define IPC_RETRY_MS 50
+
+static struct wl_event_source *ipc_idle;
+static struct wl_event_source *ipc_retry;
+
+static bool
+ipc_output_congested(struct simple_ipc_output *ipc_output)
+{
+	int fd = wl_client_get_fd(wl_resource_get_client(ipc_output->resource));
+	int queued = 0, sndbuf = 0;
+	socklen_t len = sizeof sndbuf;
+
+	if (ioctl(fd, SIOCOUTQ, &queued) < 0 || getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) < 0)
+		return false;
+	return queued > sndbuf/2;
+}
+
+static int
+ipc_retry_notify(void *data)
+{
+	ipc_flush_status();
+	return 0;
+}
+
+static void
+ipc_idle_notify(void *data)
+{
+	ipc_idle = NULL;
+	ipc_flush_status();
+}
+
+void
+ipc_flush_status()
+{
+	struct simple_output *output;
+	struct simple_ipc_output *ipc_output;
+	bool congested = false;
+
+	if (ipc_idle) {
+		wl_event_source_remove(ipc_idle);
+		ipc_idle = NULL;
+	}
+
+	wl_list_for_each(output, &g_server->outputs, link) {
+		wl_list_for_each(ipc_output, &output->ipc_outputs, link) {
+			if (!ipc_output->dirty)
+				continue;
+			if (ipc_output_congested(ipc_output)) {
+				congested = true;
+				continue;
+			}
+			ipc_output->dirty = false;
+			ipc_output_printstatus_to(ipc_output);
+		}
+	}
+
+	if (congested) {
+		if (!ipc_retry)
+			ipc_retry = wl_event_loop_add_timer(g_server->event_loop, ipc_retry_notify, NULL);
+		wl_event_source_timer_update(ipc_retry, IPC_RETRY_MS);
+	}
+}
+
 void
 ipc_output_printstatus(struct simple_output *output)
 {
 	struct simple_ipc_output *ipc_output;
 	wl_list_for_each(ipc_output, &output->ipc_outputs, link)
-		ipc_output_printstatus_to(ipc_output);
+		ipc_output->dirty = true;
+
+	if (!ipc_idle)
+		ipc_idle = wl_event_loop_add_idle(g_server->event_loop, ipc_idle_notify, NULL);
 }
 
 //--- IPC manager implementation -----------------------------------------
@@ -66,7 +145,9 @@ ipc_output_destroy(struct wl_resource *resource)
 {
 	struct simple_ipc_output *ipc_output = wl_resource_get_user_data(resource);
 	wl_list_remove(&ipc_output->link);
-	free(ipc_output);
+	alloc_free(ipc_output->title);
+	alloc_free(ipc_output->appid);
+	alloc_free(ipc_output);
 }
 
 void
@@ -85,7 +166,7 @@ ipc_manager_get_output(struct wl_client *client, struct wl_resource *resource, u
 	if (!output_resource)
 		return;
 
-	ipc_output = calloc(1, sizeof(*ipc_output));
+	ipc_output = alloc_calloc(ALLOC_IPC, 1, sizeof(*ipc_output));
 	ipc_output->resource = output_resource;
  	ipc_output->output = sop;
 	wl_resource_set_implementation(output_resource, &ipc_output_implementation, ipc_output, ipc_output_destroy);
@@ -94,59 +175,111 @@ ipc_manager_get_output(struct wl_client *client, struct wl_resource *resource, u
 	ipc_output_printstatus_to(ipc_output);
 }
 
+static struct wl_resource *action_resource;
+
 void
 ipc_manager_send_action(struct wl_client *client, struct wl_resource *resource, const char* action)
 {
    say(INFO, "ipc_output_send_action: %s", action);
+   action_resource = resource;
    process_ipc_action(action);
+   action_resource = NULL;
+}
+
+void
+ipc_reply(const char *text)
+{
+   // older dwl-ipc clients don't know the event
+   if(action_resource && wl_resource_get_version(action_resource) >= ZDWL_IPC_MANAGER_V2_MESSAGE_SINCE_VERSION)
+      zdwl_ipc_manager_v2_send_message(action_resource, text);
 }
 
 //--- IPC output implementation ------------------------------------------
+static bool
+update_string(char **cached, const char *value)
+{
+	if (*cached && !strcmp(*cached, value))
+		return false;
+	alloc_free(*cached);
+	*cached = alloc_strdup(ALLOC_IPC, value);
+	return true;
+}
+
 void
 ipc_output_printstatus_to(struct simple_ipc_output *ipc_output)
 {
 	struct simple_output *output = ipc_output->output;
 	struct simple_client *c, *focused;
-	int tagmask, state, numclients, focused_client, tag;
-   char *title, *appid;
-	
-   focused = get_top_client_from_output(output, false);
-	zdwl_ipc_output_v2_send_active(ipc_output->resource, output == g_server->cur_output);
-
-   ///////////////////////////////////////////
-   for (tag = 0 ; tag < g_config->n_tags; tag++) {
-      numclients = state = focused_client = 0;
-		tagmask = 1 << tag;
-		if ((tagmask & output->visible_tags) != 0)
-			state |= ZDWL_IPC_OUTPUT_V2_TAG_STATE_ACTIVE;
-
-		wl_list_for_each(c, &g_server->clients, link) {
-			if (c->output != output)
-				continue;
-			if (!(c->tag & tagmask))
+	struct ipc_tag_status tags[IPC_MAX_TAGS] = {0};
+	int tag, n_tags = MIN(g_config->n_tags, IPC_MAX_TAGS);
+	bool active, fullscreen, changed = false;
+	char *title, *appid, buffer[256];
+
+	focused = get_top_client_from_output(output, false);
+
+	// one pass over the clients for all tags
+	wl_list_for_each(c, &g_server->clients, link) {
+		if (c->output != output)
+			continue;
+		for (tag = 0; tag < n_tags; tag++) {
+			if (!(c->tag & TAGMASK(tag)))
 				continue;
 			if (c == focused)
-				focused_client = 1;
+				tags[tag].focused = 1;
 			if (c->urgent)
-				state |= ZDWL_IPC_OUTPUT_V2_TAG_STATE_URGENT;
-
-			numclients++;
+				tags[tag].state |= ZDWL_IPC_OUTPUT_V2_TAG_STATE_URGENT;
+			tags[tag].numclients++;
 		}
-		zdwl_ipc_output_v2_send_tag(ipc_output->resource, tag, state, numclients, focused_client);
 	}
+
+	active = output == g_server->cur_output;
+	if (!ipc_output->sent || active != ipc_output->active) {
+		zdwl_ipc_output_v2_send_active(ipc_output->resource, active);
+		ipc_output->active = active;
+		changed = true;
+	}
+
+	for (tag = 0; tag < n_tags; tag++) {
+		if (TAGMASK(tag) & output->visible_tags)
+			tags[tag].state |= ZDWL_IPC_OUTPUT_V2_TAG_STATE_ACTIVE;
+		if (ipc_output->sent && !memcmp(&tags[tag], &ipc_output->tags[tag], sizeof tags[tag]))
+			continue;
+		zdwl_ipc_output_v2_send_tag(ipc_output->resource, tag, tags[tag].state, tags[tag].numclients, tags[tag].focused);
+		ipc_output->tags[tag] = tags[tag];
+		changed = true;
+	}
+
 	title = focused ? get_client_title(focused) : "";
 	appid = focused ? get_client_appid(focused) : "";
-   ////////////////////////////////////////////////
+	if (focused && focused->unresponsive) {
+		snprintf(buffer, sizeof buffer, "%s (not responding)", title ? title : "");
+		title = buffer;
+	}
+	if (update_string(&ipc_output->title, title ? title : "broken")) {
+		zdwl_ipc_output_v2_send_title(ipc_output->resource, ipc_output->title);
+		changed = true;
+	}
+	if (update_string(&ipc_output->appid, appid ? appid : "broken")) {
+		zdwl_ipc_output_v2_send_appid(ipc_output->resource, ipc_output->appid);
+		changed = true;
+	}
 
-	zdwl_ipc_output_v2_send_title(ipc_output->resource, title ? title : "broken");
-	zdwl_ipc_output_v2_send_appid(ipc_output->resource, appid ? appid : "broken");
-	//if (wl_resource_get_version(ipc_output->resource) >= ZDWL_IPC_OUTPUT_V2_FULLSCREEN_SINCE_VERSION) {
-	//	zdwl_ipc_output_v2_send_fullscreen(ipc_output->resource, focused ? focused->isfullscreen : 0);
-	//}
+	fullscreen = focused ? focused->fullscreen : false;
+	if (wl_resource_get_version(ipc_output->resource) >= ZDWL_IPC_OUTPUT_V2_FULLSCREEN_SINCE_VERSION
+			&& (!ipc_output->sent || fullscreen != ipc_output->fullscreen)) {
+		zdwl_ipc_output_v2_send_fullscreen(ipc_output->resource, fullscreen);
+		ipc_output->fullscreen = fullscreen;
+		changed = true;
+	}
 	//if (wl_resource_get_version(ipc_output->resource) >= ZDWL_IPC_OUTPUT_V2_FLOATING_SINCE_VERSION) {
 	//	zdwl_ipc_output_v2_send_floating(ipc_output->resource, focused ? focused->isfloating : 0);
 	//}
-	zdwl_ipc_output_v2_send_frame(ipc_output->resource);
+
+	ipc_output->sent = true;
+	if (changed) {
+		zdwl_ipc_output_v2_send_frame(ipc_output->resource);
+		g_server->counters.ipc_frames++;
+	}
 }
 
 void
@@ -202,3 +335,39 @@ ipc_output_set_tags(struct wl_client *client, struct wl_resource *resource, uint
 	print_server_info();
 }
 
+//--- Traced requests ----------------------------------------------------
+void
+traced_get_output(struct wl_client *client, struct wl_resource *resource, uint32_t id, struct wl_resource *output)
+{
+	g_server->counters.ipc_requests++;
+	uint64_t start = trace_begin("ipc_manager_get_output");
+	ipc_manager_get_output(client, resource, id, output);
+	trace_end("ipc_manager_get_output", start);
+}
+
+void
+traced_send_action(struct wl_client *client, struct wl_resource *resource, const char* action)
+{
+	g_server->counters.ipc_requests++;
+	uint64_t start = trace_begin("ipc_manager_send_action");
+	ipc_manager_send_action(client, resource, action);
+	trace_end("ipc_manager_send_action", start);
+}
+
+void
+traced_set_client_tags(struct wl_client *client, struct wl_resource *resource, uint32_t and_tags, uint32_t xor_tags)
+{
+	g_server->counters.ipc_requests++;
+	uint64_t start = trace_begin("ipc_output_set_client_tags");
+	ipc_output_set_client_tags(client, resource, and_tags, xor_tags);
+	trace_end("ipc_output_set_client_tags", start);
+}
+
+void
+traced_set_tags(struct wl_client *client, struct wl_resource *resource, uint32_t tagmask, uint32_t toggle_tagset)
+{
+	g_server->counters.ipc_requests++;
+	uint64_t start = trace_begin("ipc_output_set_tags");
+	ipc_output_set_tags(client, resource, tagmask, toggle_tagset);
+	trace_end("ipc_output_set_tags", start);
+}
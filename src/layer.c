@@ -11,6 +11,9 @@
 #include "input.h"
 #include "client.h"
 #include "server.h"
+#include "trace.h"
+#include "stats.h"
+#include "alloc.h"
 
 static const int layermap[] = {LyrBg, LyrBottom, LyrTop, LyrOverlay };
 
@@ -27,6 +30,11 @@ arrange_layer(struct wl_list *list, const struct wlr_box *full_area, struct wlr_
          continue;
       
       wlr_scene_layer_surface_v1_configure(surface->scene_layer_surface, full_area, usable_area);
+      if(!wl_list_empty(&wlr_lsurface->configure_list)) {
+         struct wlr_layer_surface_v1_configure *configure = 
+            wl_container_of(wlr_lsurface->configure_list.prev, configure, link);
+         surface_stats_configure(&surface->stats, configure->serial);
+      }
       wlr_scene_node_set_position(&surface->popups->node, surface->scene_tree->node.x, surface->scene_tree->node.y);
       surface->geom.x = surface->scene_tree->node.x;
       surface->geom.y = surface->scene_tree->node.y;
@@ -49,6 +57,7 @@ arrange_layers(struct simple_output *output)
       say(DEBUG, "no wlr_scene_output");
       return;
    }
+   uint64_t start_ns = trace_begin("arrange_layers");
 
    for(int i=N_LAYER_SHELL_LAYERS-1; i>=0; i--){
       // process exclusive-zone clients from top to bottom
@@ -66,6 +75,24 @@ arrange_layers(struct simple_output *output)
       // set node position to account for output layout change
       //wlr_scene_node_set_position(&server->layer_tree[i]->node, scene_output->x, scene_output->y);
    }
+   trace_end("arrange_layers", start_ns);
+}
+
+void
+set_layers_enabled(struct simple_output *output, bool enabled)
+{
+   struct simple_layer_surface *lsurface;
+
+   // background, bottom and top are hidden behind fullscreen clients, overlay stays
+   for(int i=0; i<N_LAYER_SHELL_LAYERS; i++) {
+      if(i == ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY) continue;
+
+      wl_list_for_each(lsurface, &output->layer_shells[i], link) {
+         bool mapped = lsurface->scene_layer_surface->layer_surface->surface->mapped;
+         wlr_scene_node_set_enabled(&lsurface->scene_tree->node, enabled && mapped);
+         wlr_scene_node_set_enabled(&lsurface->popups->node, enabled);
+      }
+   }
 }
 
 //--- Notify functions ---------------------------------------------------
@@ -106,6 +133,9 @@ layer_surface_commit_notify(struct wl_listener *listener, void *data)
    if(!wlr_output || !(lsurface->output = wlr_output->data))
       return;
 
+   surface_stats_commit(&lsurface->stats, wlr_lsurface->surface, lsurface->output);
+   surface_stats_ack(&lsurface->stats, wlr_lsurface->current.configure_serial);
+
    if(layer != lsurface->scene_tree->node.parent) {
       wlr_scene_node_reparent(&lsurface->scene_tree->node, layer);
       wlr_scene_node_reparent(&lsurface->popups->node, layer);
@@ -128,12 +158,12 @@ layer_surface_destroy_notify(struct wl_listener *listener, void *data)
    struct simple_output * output = g_server->cur_output;
 
    wl_list_remove(&lsurface->link);
-   wl_list_remove(&lsurface->destroy.link);
-   wl_list_remove(&lsurface->map.link);
-   wl_list_remove(&lsurface->unmap.link);
-   wl_list_remove(&lsurface->surface_commit.link);
+   UNLISTEN(&lsurface->destroy);
+   UNLISTEN(&lsurface->map);
+   UNLISTEN(&lsurface->unmap);
+   UNLISTEN(&lsurface->surface_commit);
    //wlr_scene_node_destroy(&lsurface->scene_tree->node);
-   free(lsurface);
+   alloc_free(lsurface);
 
    focus_client(get_top_client_from_output(output, false), true);
 }
@@ -153,7 +183,7 @@ layer_new_surface_notify(struct wl_listener *listener, void *data)
    struct simple_output *output = layer_surface->output->data;
    struct wlr_scene_tree *selected_layer = g_server->layer_tree[layermap[layer_surface->pending.layer]];
 
-   struct simple_layer_surface *lsurface = calloc(1, sizeof(struct simple_layer_surface));
+   struct simple_layer_surface *lsurface = alloc_calloc(ALLOC_LAYER, 1, sizeof(struct simple_layer_surface));
    lsurface->type = LAYER_SHELL_CLIENT;
    lsurface->output = output;
 
@@ -0,0 +1,276 @@
+/*
+ * log.c
+ *   - say() output and a ring of recent messages
+ */
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "globals.h"
+#include "log.h"
+
+#define CRED      "\033[31m"
+#define CGREEN    "\033[32m"
+#define CYELLOW   "\033[33m"
+#define CBLUE     "\033[34m"
+#define CPURPLE   "\033[35m"
+#define CRESET    "\033[0m"
+
+static const char *msg_str[NMSG] = { CBLUE"DEBUG"CRESET, "INFO", CYELLOW"WARNING"CRESET, CRED"ERROR"CRESET };
+static const char *ring_str[NMSG] = { "DEBUG", "INFO", "WARNING", "ERROR" };
+
+// lowest level printed to stdout, and lowest level kept in the ring
+static int print_level = INFO;
+static int ring_level = INFO;
+int g_say_level = INFO;
+
+// Fixed size records of the format string and its raw arguments, formatted only
+// when the ring is dumped. A writer claims a slot with one atomic increment and
+// publishes it by storing its sequence number last, so say() never blocks and
+// a reader can tell a record that was overwritten while it copied it.
+union log_arg {
+   long long i;
+   double d;
+   const void *p;
+   int s;               // offset of a %s argument in strings[]
+};
+
+struct log_record {
+   atomic_ulong seq;
+   struct timespec time;
+   int level;
+   const char *format;  // string literal from say(), NULL if strings[] holds the text
+   union log_arg args[LOG_RING_ARGS];
+   char strings[LOG_RING_STRINGS];
+};
+
+static struct log_record ring[LOG_RING_SIZE];
+static atomic_ulong ring_head;
+
+//------------------------------------------------------------------------
+// Splits off the conversion at 'format' (just past the %) into 'spec', returns
+// its conversion character and sets 'end' past it. '*' are not resolved here.
+static char
+next_spec(const char *format, const char **end, char *spec, size_t size, char *length)
+{
+   size_t n = 0;
+   const char *p = format;
+   spec[n++] = '%';
+
+   while(*p && strchr("-+ #0", *p)) p++;
+   while(*p && strchr("0123456789*", *p)) p++;
+   if(*p=='.') for(p++; *p && strchr("0123456789*", *p); p++);
+
+   // the length is dropped from the spec, arguments are stored widened
+   const char *len = p;
+   while(*p && strchr("hlqjztL", *p)) p++;
+   *length = p>len ? *len : '\0';
+   if(p-len==2 && len[0]=='l') *length = 'q';
+
+   size_t flags = MIN((size_t)(len - format), size-3);
+   memcpy(spec+n, format, flags);
+   n += flags;
+   spec[n] = '\0';
+   *end = *p ? p+1 : p;
+   return *p;
+}
+
+static bool
+is_int_spec(char conv)
+{
+   return conv && strchr("diouxXcbB", conv);
+}
+
+static bool
+is_float_spec(char conv)
+{
+   return conv && strchr("fFeEgGaA", conv);
+}
+
+static long long
+int_arg(va_list *args, char conv, char length)
+{
+   bool sign = conv=='d' || conv=='i';
+   switch(length) {
+      case 'l': return sign ? va_arg(*args, long) : (long long)va_arg(*args, unsigned long);
+      case 'q': return va_arg(*args, long long);
+      case 'j': return va_arg(*args, intmax_t);
+      case 'z': return va_arg(*args, size_t);
+      case 't': return va_arg(*args, ptrdiff_t);
+      default:  return sign ? va_arg(*args, int) : (long long)va_arg(*args, unsigned int);
+   }
+}
+
+// copies the arguments of 'format'; false if they don't fit a record
+static bool
+copy_args(struct log_record *rec, const char *format, va_list args)
+{
+   char spec[32], length;
+   int n_args = 0, used = 0;
+   va_list ap;
+   va_copy(ap, args);
+
+   for(const char *p = strchr(format, '%'); p; p = strchr(p, '%')) {
+      if(p[1]=='%') { p += 2; continue; }
+      const char *start = p+1;
+      char conv = next_spec(start, &p, spec, sizeof spec, &length);
+
+      int stars = 0;
+      for(const char *c = start; c<p; c++) stars += *c=='*';
+      if(n_args + stars + 1 > LOG_RING_ARGS) { va_end(ap); return false; }
+      while(stars--) rec->args[n_args++].i = va_arg(ap, int);
+
+      union log_arg *arg = &rec->args[n_args++];
+      if(is_int_spec(conv))         arg->i = int_arg(&ap, conv, length);
+      else if(is_float_spec(conv))  arg->d = length=='L' ? (double)va_arg(ap, long double) : va_arg(ap, double);
+      else if(conv=='p')            arg->p = va_arg(ap, void*);
+      else if(conv=='s') {
+         // the string may be gone by the time the ring is dumped
+         const char *str = va_arg(ap, const char*);
+         if(!str) str = "(null)";
+         size_t len = MIN(strlen(str), (size_t)(LOG_RING_STRINGS-1 - used));
+         memcpy(rec->strings + used, str, len);
+         rec->strings[used + len] = '\0';
+         arg->s = used;
+         used = MIN(used + (int)len + 1, LOG_RING_STRINGS-1);
+      }
+      else { va_end(ap); return false; }
+   }
+   va_end(ap);
+   return true;
+}
+
+static void
+ring_add(int level, const char *format, va_list args)
+{
+   unsigned long seq = atomic_fetch_add_explicit(&ring_head, 1, memory_order_relaxed);
+   struct log_record *rec = &ring[seq & (LOG_RING_SIZE-1)];
+
+   atomic_store_explicit(&rec->seq, 0, memory_order_relaxed);
+   atomic_thread_fence(memory_order_release);
+
+   clock_gettime(CLOCK_MONOTONIC, &rec->time);
+   rec->level = level;
+   rec->format = format;
+
+   // too many arguments or one we don't know: keep the text instead
+   if(!copy_args(rec, format, args)) {
+      rec->format = NULL;
+      vsnprintf(rec->strings, LOG_RING_STRINGS, format, args);
+   }
+
+   atomic_store_explicit(&rec->seq, seq+1, memory_order_release);
+}
+
+// formats a copied record, one conversion at a time
+static void
+format_record(struct log_record *rec, char *out, size_t size)
+{
+   if(!rec->format) {
+      snprintf(out, size, "%s", rec->strings);
+      return;
+   }
+
+   char spec[48], length;
+   size_t n = 0;
+   int n_args = 0;
+   const char *p = rec->format;
+
+   while(*p && n<size-1) {
+      if(*p!='%' || p[1]=='%') {
+         out[n++] = *p;
+         p += *p=='%' ? 2 : 1;
+         continue;
+      }
+      char conv = next_spec(p+1, &p, spec, sizeof spec - 3, &length);
+
+      // '*' are replaced by the widths stored ahead of the argument
+      char resolved[48];
+      size_t r = 0;
+      for(char *c = spec; *c && r<sizeof resolved - 16; c++) {
+         if(*c=='*') r += snprintf(resolved + r, sizeof resolved - r, "%d", (int)rec->args[n_args++].i);
+         else        resolved[r++] = *c;
+      }
+      union log_arg *arg = &rec->args[n_args++];
+
+      if(is_int_spec(conv) && conv!='c') {
+         resolved[r++] = 'l';
+         resolved[r++] = 'l';
+      }
+      resolved[r++] = conv;
+      resolved[r] = '\0';
+
+      int len;
+      if(conv=='c')              len = snprintf(out + n, size - n, resolved, (int)arg->i);
+      else if(is_int_spec(conv)) len = snprintf(out + n, size - n, resolved, arg->i);
+      else if(is_float_spec(conv)) len = snprintf(out + n, size - n, resolved, arg->d);
+      else if(conv=='p')         len = snprintf(out + n, size - n, resolved, arg->p);
+      else                       len = snprintf(out + n, size - n, resolved, rec->strings + arg->s);
+      if(len>0) n = MIN(n + len, size-1);
+   }
+   out[n] = '\0';
+}
+
+//------------------------------------------------------------------------
+void
+log_set_levels(int print, int keep)
+{
+   print_level = print;
+   ring_level = keep;
+   g_say_level = MIN(print_level, ring_level);
+}
+
+void
+say_impl(int level, const char* message, ...) 
+{
+   va_list args;
+   va_start(args, message);
+   if(level>=ring_level)
+      ring_add(level, message, args);
+   va_end(args);
+
+   if(level>=print_level || level==ERROR) {
+      char buffer[256];
+      va_start(args, message);
+      vsnprintf(buffer, 256, message, args);
+      va_end(args);
+      printf("SimpleWC [%s]: %s\n", msg_str[level], buffer);
+   }
+
+   if(level==ERROR) exit(EXIT_FAILURE);
+}
+
+void
+log_ring_dump(void (*emit)(const char*, void*), void *data)
+{
+   unsigned long head = atomic_load_explicit(&ring_head, memory_order_acquire);
+   unsigned long first = head > LOG_RING_SIZE ? head - LOG_RING_SIZE : 0;
+   char text[256];
+   char line[sizeof text + 48];
+
+   for(unsigned long seq=first; seq<head; seq++) {
+      struct log_record *rec = &ring[seq & (LOG_RING_SIZE-1)];
+      if(atomic_load_explicit(&rec->seq, memory_order_acquire) != seq+1) continue;
+
+      struct log_record copy;
+      copy.time = rec->time;
+      copy.level = rec->level;
+      copy.format = rec->format;
+      memcpy(copy.args, rec->args, sizeof copy.args);
+      memcpy(copy.strings, rec->strings, LOG_RING_STRINGS);
+
+      // skip records a writer started to reuse while they were copied
+      atomic_thread_fence(memory_order_acquire);
+      if(atomic_load_explicit(&rec->seq, memory_order_relaxed) != seq+1) continue;
+
+      copy.strings[LOG_RING_STRINGS-1] = '\0';
+      format_record(&copy, text, sizeof text);
+      snprintf(line, sizeof line, "[%5ld.%06ld] %s: %s", (long)copy.time.tv_sec, copy.time.tv_nsec/1000,
+            ring_str[copy.level<NMSG ? copy.level : INFO], text);
+      emit(line, data);
+   }
+}
@@ -0,0 +1,228 @@
+/*
+ * metrics.c
+ *   - Prometheus text format over HTTP on a Unix socket (metrics_socket),
+ *     rendered from the server counters only when scraped
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <wlr/backend/session.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/box.h>
+
+#include "globals.h"
+#include "layer.h"
+#include "client.h"
+#include "server.h"
+#include "trace.h"
+#include "metrics.h"
+
+#define METRICS_TIMEOUT_MS 1000
+
+struct metrics_connection {
+   int fd;
+   struct wl_event_source *source;
+   struct wl_event_source *timer;
+
+   char *response;      // header and body, once the request was read
+   size_t len, sent;
+};
+
+static int listen_fd = -1;
+static struct wl_event_source *listen_source;
+static struct sockaddr_un address;
+
+//------------------------------------------------------------------------
+static long
+resident_bytes()
+{
+   long pages = 0, resident = 0;
+   FILE *f = fopen("/proc/self/statm", "r");
+   if(!f) return 0;
+   if(fscanf(f, "%ld %ld", &pages, &resident)!=2) resident = 0;
+   fclose(f);
+   return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void
+render(FILE *body)
+{
+   struct server_counters *c = &g_server->counters;
+   struct simple_client *client;
+   struct simple_output *output;
+   struct trace_stats stalls;
+   int n_clients = 0, n_unresponsive = 0;
+
+   trace_get_stats(&stalls);
+
+   fprintf(body, "# TYPE simplewc_frame_duration_seconds summary\n"
+         "simplewc_frame_duration_seconds_sum %.6f\nsimplewc_frame_duration_seconds_count %llu\n",
+         c->frame_ns/1e9, (unsigned long long)c->frames);
+   fprintf(body, "# TYPE simplewc_input_events_total counter\n"
+         "simplewc_input_events_total{device=\"keyboard\"} %llu\nsimplewc_input_events_total{device=\"pointer\"} %llu\n",
+         (unsigned long long)c->key_events, (unsigned long long)c->pointer_events);
+   fprintf(body, "# TYPE simplewc_ipc_requests_total counter\nsimplewc_ipc_requests_total %llu\n"
+         "# TYPE simplewc_ipc_status_frames_total counter\nsimplewc_ipc_status_frames_total %llu\n",
+         (unsigned long long)c->ipc_requests, (unsigned long long)c->ipc_frames);
+   fprintf(body, "# TYPE simplewc_stalls_total counter\nsimplewc_stalls_total %lu\n"
+         "# TYPE simplewc_stall_worst_seconds gauge\nsimplewc_stall_worst_seconds %.6f\n",
+         stalls.stalls, stalls.worst_ns/1e9);
+   fprintf(body, "# TYPE simplewc_resident_memory_bytes gauge\nsimplewc_resident_memory_bytes %ld\n",
+         resident_bytes());
+
+   wl_list_for_each(client, &g_server->clients, link) {
+      n_clients++;
+      n_unresponsive += client->unresponsive;
+   }
+   fprintf(body, "# TYPE simplewc_clients gauge\nsimplewc_clients %d\n"
+         "# TYPE simplewc_clients_unresponsive gauge\nsimplewc_clients_unresponsive %d\n",
+         n_clients, n_unresponsive);
+
+   // each family's samples must follow its own TYPE line
+   fprintf(body, "# TYPE simplewc_tag_clients gauge\n");
+   wl_list_for_each(output, &g_server->outputs, link) {
+      for(int tag=0; tag<g_config->n_tags; tag++) {
+         int n = 0;
+         wl_list_for_each(client, &g_server->clients, link)
+            if(client->output==output && (client->tag & TAGMASK(tag))) n++;
+         fprintf(body, "simplewc_tag_clients{output=\"%s\",tag=\"%d\"} %d\n", output->wlr_output->name, tag+1, n);
+      }
+   }
+   fprintf(body, "# TYPE simplewc_tag_visible gauge\n");
+   wl_list_for_each(output, &g_server->outputs, link)
+      for(int tag=0; tag<g_config->n_tags; tag++)
+         fprintf(body, "simplewc_tag_visible{output=\"%s\",tag=\"%d\"} %d\n", output->wlr_output->name, tag+1,
+               (output->visible_tags & TAGMASK(tag)) ? 1 : 0);
+}
+
+//------------------------------------------------------------------------
+static void
+connection_close(struct metrics_connection *conn)
+{
+   wl_event_source_remove(conn->source);
+   wl_event_source_remove(conn->timer);
+   close(conn->fd);
+   free(conn->response);
+   free(conn);
+}
+
+static int
+connection_timeout(void *data)
+{
+   connection_close(data);
+   return 0;
+}
+
+static bool
+prepare_response(struct metrics_connection *conn)
+{
+   char *body;
+   size_t len;
+   FILE *f = open_memstream(&body, &len);
+   if(!f) return false;
+   render(f);
+   if(fclose(f)) return false;
+
+   char header[128];
+   int n = snprintf(header, sizeof header, "HTTP/1.0 200 OK\r\n"
+         "Content-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", len);
+   if((conn->response = malloc(n + len))) {
+      memcpy(conn->response, header, n);
+      memcpy(conn->response + n, body, len);
+      conn->len = n + len;
+   }
+   free(body);
+   return conn->response!=NULL;
+}
+
+// answer whatever was asked, a scrape is the only thing served here; what
+// doesn't fit the socket is sent once it is writable again
+static int
+connection_notify(int fd, uint32_t mask, void *data)
+{
+   struct metrics_connection *conn = data;
+   char request[512];
+
+   if(!conn->response && (!(mask & WL_EVENT_READABLE) || recv(fd, request, sizeof request, MSG_DONTWAIT) <= 0
+            || !prepare_response(conn))) {
+      connection_close(conn);
+      return 0;
+   }
+
+   while(conn->sent < conn->len) {
+      ssize_t n = send(fd, conn->response + conn->sent, conn->len - conn->sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if(n<0 && errno==EINTR) continue;
+      if(n<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) {
+         wl_event_source_fd_update(conn->source, WL_EVENT_WRITABLE);
+         return 0;
+      }
+      if(n<=0) break;
+      conn->sent += n;
+   }
+   connection_close(conn);
+   return 0;
+}
+
+static int
+listen_readable(int fd, uint32_t mask, void *data)
+{
+   int client_fd = accept(fd, NULL, NULL);
+   if(client_fd<0) return 0;
+   fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+   fcntl(client_fd, F_SETFL, O_NONBLOCK);
+
+   struct metrics_connection *conn = calloc(1, sizeof(struct metrics_connection));
+   if(!conn) {
+      close(client_fd);
+      return 0;
+   }
+   conn->fd = client_fd;
+   conn->source = wl_event_loop_add_fd(g_server->event_loop, client_fd, WL_EVENT_READABLE, connection_notify, conn);
+   conn->timer = wl_event_loop_add_timer(g_server->event_loop, connection_timeout, conn);
+   wl_event_source_timer_update(conn->timer, METRICS_TIMEOUT_MS);
+   return 0;
+}
+
+//------------------------------------------------------------------------
+void
+metrics_start(const char *path)
+{
+   if(!path[0]) return;
+
+   address.sun_family = AF_UNIX;
+   if(path[0]=='/')
+      snprintf(address.sun_path, sizeof address.sun_path, "%s", path);
+   else
+      snprintf(address.sun_path, sizeof address.sun_path, "%s/%s", getenv("XDG_RUNTIME_DIR"), path);
+
+   if((listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0) {
+      say(WARNING, "Cannot create metrics socket: %s", strerror(errno));
+      return;
+   }
+
+   unlink(address.sun_path);
+   if(bind(listen_fd, (struct sockaddr*)&address, sizeof address) < 0 || listen(listen_fd, 4) < 0) {
+      say(WARNING, "Cannot listen on %s: %s", address.sun_path, strerror(errno));
+      close(listen_fd);
+      listen_fd = -1;
+      return;
+   }
+
+   listen_source = wl_event_loop_add_fd(g_server->event_loop, listen_fd, WL_EVENT_READABLE, listen_readable, NULL);
+   say(INFO, " -> Metrics served on %s", address.sun_path);
+}
+
+void
+metrics_finish()
+{
+   if(listen_fd<0) return;
+
+   wl_event_source_remove(listen_source);
+   close(listen_fd);
+   unlink(address.sun_path);
+   listen_fd = -1;
+}
@@ -0,0 +1,443 @@
+#include <regex.h>
+#include <string.h>
+#include <wlr/backend/session.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+
+#include "globals.h"
+#include "layer.h"
+#include "client.h"
+#include "server.h"
+#include "rule.h"
+#include "alloc.h"
+
+/*
+ * RULE = appid:<pattern> title:<pattern> tag:<n> output:<name>
+ *        geometry:<w>x<h>[+<x>+<y>] fixed:<bool> visible:<bool> suspend:(hidden|never)
+ *
+ * Patterns are globs (* and ?), or extended regex when written as /regex/.
+ * Other characters, [ included, match themselves.
+ * Rules are applied in order, later rules override earlier ones.
+ *
+ * The globs of all rules are compiled into one automaton per field, which
+ * reports every rule whose pattern matches in a single pass over the app_id or
+ * title. Only /regex/ patterns are run on their own, for rules that got that far.
+ */
+enum PatternKind { PATTERN_ANY, PATTERN_GLOB, PATTERN_REGEX };
+
+struct pattern {
+   enum PatternKind kind;
+   regex_t regex;
+   char *glob;             // until it is added to the glob set
+};
+
+struct window_rule {
+   struct pattern appid;
+   struct pattern title;
+
+   int tag;
+   char output[32];
+   int x, y, width, height;
+   bool has_position;
+   bool has_size;
+   int fixed;              // -1 if not set by the rule
+   int visible;
+   int suspend;
+};
+
+#define GLOB_MAX_STATES 256
+
+// one state of the lazily built DFA: a set of glob positions
+struct glob_state {
+   uint64_t *positions;
+   short next[256];        // -1 until the transition is first taken
+};
+
+// NFA of all globs of one field; a pattern occupies one position per character
+// and a final '\0' position, which accepts the rule in owner[]
+struct glob_set {
+   char *chars;
+   int *owner;
+   int n_pos;
+   int n_words;
+
+   struct glob_state *states;
+   int n_states, capacity;
+   unsigned flushes;
+   uint64_t *scratch;
+};
+
+struct rule_set {
+   struct window_rule *rules;
+   int n_rules;
+   int capacity;
+
+   struct glob_set appid_globs;
+   struct glob_set title_globs;
+
+   // per rule bits, for those that match any app_id or title without a glob
+   bool failed;            // out of memory while adding rules
+
+   int n_words;
+   uint64_t *appid_default;
+   uint64_t *title_default;
+   uint64_t *appid_match;
+   uint64_t *title_match;
+};
+
+#define WORDS(n)     (((n)+63)/64)
+#define BIT_SET(b,i) ((b)[(i)/64] |= 1ull << ((i)%64))
+#define BIT_GET(b,i) ((b)[(i)/64] >> ((i)%64) & 1)
+
+//------------------------------------------------------------------------
+// allocation failures return false or -1 instead of exiting: rule sets are
+// compiled on a worker when the config is reloaded
+static bool
+glob_add(struct glob_set *set, const char *glob, int rule)
+{
+   size_t len = strlen(glob) + 1;
+   char *chars = alloc_realloc(ALLOC_CONFIG, set->chars, set->n_pos + len);
+   if(chars) set->chars = chars;
+   int *owner = alloc_realloc(ALLOC_CONFIG, set->owner, (set->n_pos + len) * sizeof(int));
+   if(owner) set->owner = owner;
+   if(!chars || !owner) return false;
+
+   memcpy(set->chars + set->n_pos, glob, len);
+   for(size_t i=0; i<len; i++) set->owner[set->n_pos + i] = rule;
+   set->n_pos += len;
+   return true;
+}
+
+// a '*' may match nothing, so the position after it is active too
+static void
+glob_close(struct glob_set *set, uint64_t *positions)
+{
+   for(int i=0; i<set->n_pos; i++)
+      if(BIT_GET(positions, i) && set->chars[i]=='*') BIT_SET(positions, i+1);
+}
+
+static int
+glob_state(struct glob_set *set, uint64_t *positions)
+{
+   for(int i=0; i<set->n_states; i++)
+      if(!memcmp(set->states[i].positions, positions, set->n_words * sizeof(uint64_t))) return i;
+
+   // the cache is full: keep the start state and build the rest again
+   if(set->n_states==GLOB_MAX_STATES) {
+      for(int i=1; i<set->n_states; i++) alloc_free(set->states[i].positions);
+      memset(set->states[0].next, -1, sizeof set->states[0].next);
+      set->n_states = 1;
+      set->flushes++;
+   }
+   if(set->n_states==set->capacity) {
+      int capacity = set->capacity ? set->capacity*2 : 8;
+      struct glob_state *states = alloc_realloc(ALLOC_CONFIG, set->states, capacity * sizeof(struct glob_state));
+      if(!states) return -1;
+      set->states = states;
+      set->capacity = capacity;
+   }
+
+   struct glob_state *state = &set->states[set->n_states];
+   if(!(state->positions = alloc_calloc(ALLOC_CONFIG, set->n_words, sizeof(uint64_t)))) return -1;
+   memcpy(state->positions, positions, set->n_words * sizeof(uint64_t));
+   memset(state->next, -1, sizeof state->next);
+   return set->n_states++;
+}
+
+static bool
+glob_compile(struct glob_set *set)
+{
+   if(!set->n_pos) return true;
+
+   set->n_words = WORDS(set->n_pos);
+   if(!(set->scratch = alloc_calloc(ALLOC_CONFIG, set->n_words, sizeof(uint64_t)))) return false;
+
+   // the start state has the first position of every pattern
+   for(int i=0; i<set->n_pos; i++)
+      if(i==0 || !set->chars[i-1]) BIT_SET(set->scratch, i);
+   glob_close(set, set->scratch);
+   return glob_state(set, set->scratch)==0;
+}
+
+static int
+glob_step(struct glob_set *set, int from, unsigned char c)
+{
+   uint64_t *positions = set->states[from].positions;
+   uint64_t *next = set->scratch;
+   memset(next, 0, set->n_words * sizeof(uint64_t));
+
+   for(int i=0; i<set->n_pos; i++) {
+      if(!BIT_GET(positions, i) || !set->chars[i]) continue;
+      if(set->chars[i]=='*')                         BIT_SET(next, i);
+      else if(set->chars[i]=='?' || set->chars[i]==c) BIT_SET(next, i+1);
+   }
+   glob_close(set, next);
+
+   // a flush may have dropped 'from'
+   unsigned flushes = set->flushes;
+   int to = glob_state(set, next);
+   if(to>=0 && flushes==set->flushes) set->states[from].next[c] = to;
+   return to;
+}
+
+// sets the bit of every rule whose glob matches all of 'str'
+static bool
+glob_match(struct glob_set *set, const char *str, uint64_t *rules)
+{
+   if(!set->n_states) return true;
+
+   int state = 0;
+   for(const unsigned char *c = (const unsigned char*)str; *c; c++) {
+      int next = set->states[state].next[*c];
+      if((state = next>=0 ? next : glob_step(set, state, *c)) < 0) return false;
+   }
+
+   uint64_t *positions = set->states[state].positions;
+   for(int w=0; w<set->n_words; w++)
+      for(uint64_t bits = positions[w]; bits; bits &= bits-1) {
+         int i = w*64 + __builtin_ctzll(bits);
+         if(!set->chars[i]) BIT_SET(rules, set->owner[i]);
+      }
+   return true;
+}
+
+static void
+glob_free(struct glob_set *set)
+{
+   for(int i=0; i<set->n_states; i++) alloc_free(set->states[i].positions);
+   alloc_free(set->states);
+   alloc_free(set->chars);
+   alloc_free(set->owner);
+   alloc_free(set->scratch);
+}
+
+//------------------------------------------------------------------------
+static bool
+parse_pattern(struct rule_set *set, struct pattern *pattern, const char *arg)
+{
+   size_t len = strlen(arg);
+   if(pattern->kind!=PATTERN_ANY) return false;
+
+   // /regex/ is used verbatim
+   if(len>1 && arg[0]=='/' && arg[len-1]=='/') {
+      char *regex = alloc_strdup(ALLOC_CONFIG, arg+1);
+      if(!regex) {
+         set->failed = true;
+         return false;
+      }
+      regex[len-2] = '\0';
+
+      int err = regcomp(&pattern->regex, regex, REG_EXTENDED | REG_NOSUB);
+      alloc_free(regex);
+      if(err) {
+         say(WARNING, "Invalid window rule pattern '%s'", arg);
+         return false;
+      }
+      pattern->kind = PATTERN_REGEX;
+      return true;
+   }
+
+   if(!(pattern->glob = alloc_strdup(ALLOC_CONFIG, arg))) {
+      set->failed = true;
+      return false;
+   }
+   pattern->kind = PATTERN_GLOB;
+   return true;
+}
+
+static bool
+pattern_regex_matches(struct pattern *pattern, const char *str)
+{
+   return pattern->kind!=PATTERN_REGEX || !regexec(&pattern->regex, str, 0, NULL, 0);
+}
+
+static void
+free_pattern(struct pattern *pattern)
+{
+   if(pattern->kind==PATTERN_REGEX) regfree(&pattern->regex);
+   alloc_free(pattern->glob);
+   pattern->glob = NULL;
+}
+
+static int
+parse_bool(const char *value)
+{
+   return !strcmp(value, "true") ? 1 : 0;
+}
+
+static void
+free_rule(struct window_rule *rule)
+{
+   free_pattern(&rule->appid);
+   free_pattern(&rule->title);
+}
+
+//------------------------------------------------------------------------
+struct rule_set*
+rule_set_create()
+{
+   return alloc_calloc(ALLOC_CONFIG, 1, sizeof(struct rule_set));
+}
+
+void
+rule_set_destroy(struct rule_set *set)
+{
+   if(!set) return;
+
+   for(int i=0; i<set->n_rules; i++)
+      free_rule(&set->rules[i]);
+   glob_free(&set->appid_globs);
+   glob_free(&set->title_globs);
+   alloc_free(set->rules);
+   alloc_free(set->appid_default);
+   alloc_free(set->title_default);
+   alloc_free(set->appid_match);
+   alloc_free(set->title_match);
+   alloc_free(set);
+}
+
+bool
+rule_set_add(struct rule_set *set, char *value)
+{
+   struct window_rule rule = { .tag = -1, .fixed = -1, .visible = -1, .suspend = -1 };
+   bool valid = true;
+   char *saveptr;
+
+   for(char *token = strtok_r(value, " ", &saveptr); token; token = strtok_r(NULL, " ", &saveptr)) {
+      char *arg = strchr(token, ':');
+      if(!arg) { valid = false; break; }
+      *arg++ = '\0';
+
+      if(!strcmp(token, "appid")) {
+         if(!parse_pattern(set, &rule.appid, arg)) { valid = false; break; }
+      }
+      else if(!strcmp(token, "title")) {
+         if(!parse_pattern(set, &rule.title, arg)) { valid = false; break; }
+      }
+      else if(!strcmp(token, "tag"))      rule.tag = atoi(arg);
+      else if(!strcmp(token, "output"))   strncpy(rule.output, arg, sizeof rule.output - 1);
+      else if(!strcmp(token, "fixed"))    rule.fixed = parse_bool(arg);
+      else if(!strcmp(token, "visible"))  rule.visible = parse_bool(arg);
+      else if(!strcmp(token, "suspend"))  rule.suspend = !strcmp(arg, "hidden") ? 1 : 0;
+      else if(!strcmp(token, "geometry")) {
+         int n = sscanf(arg, "%dx%d+%d+%d", &rule.width, &rule.height, &rule.x, &rule.y);
+         rule.has_size = n>=2 && rule.width>0 && rule.height>0;
+         rule.has_position = n==4;
+      }
+      else { valid = false; break; }
+   }
+
+   if(!valid || set->failed) {
+      if(!set->failed) say(WARNING, "Ignoring invalid window rule");
+      free_rule(&rule);
+      return false;
+   }
+
+   if(set->n_rules == set->capacity) {
+      int capacity = set->capacity ? set->capacity*2 : 8;
+      struct window_rule *rules = alloc_realloc(ALLOC_CONFIG, set->rules, capacity * sizeof(struct window_rule));
+      if(!rules) {
+         set->failed = true;
+         free_rule(&rule);
+         return false;
+      }
+      set->rules = rules;
+      set->capacity = capacity;
+   }
+   set->rules[set->n_rules++] = rule;
+   return true;
+}
+
+// false if memory ran out here or while rules were added
+bool
+rule_set_compile(struct rule_set *set)
+{
+   if(set->failed) return false;
+
+   set->n_words = WORDS(set->n_rules);
+   set->appid_default = alloc_calloc(ALLOC_CONFIG, set->n_words, sizeof(uint64_t));
+   set->title_default = alloc_calloc(ALLOC_CONFIG, set->n_words, sizeof(uint64_t));
+   set->appid_match = alloc_calloc(ALLOC_CONFIG, set->n_words, sizeof(uint64_t));
+   set->title_match = alloc_calloc(ALLOC_CONFIG, set->n_words, sizeof(uint64_t));
+   if(set->n_rules && (!set->appid_default || !set->title_default || !set->appid_match || !set->title_match))
+      return false;
+
+   // globs go into the automata, the other rules match until a regex says no
+   for(int i=0; i<set->n_rules; i++) {
+      struct window_rule *rule = &set->rules[i];
+
+      if(rule->appid.kind!=PATTERN_GLOB)                      BIT_SET(set->appid_default, i);
+      else if(!glob_add(&set->appid_globs, rule->appid.glob, i)) return false;
+      if(rule->title.kind!=PATTERN_GLOB)                      BIT_SET(set->title_default, i);
+      else if(!glob_add(&set->title_globs, rule->title.glob, i)) return false;
+
+      alloc_free(rule->appid.glob);
+      alloc_free(rule->title.glob);
+      rule->appid.glob = rule->title.glob = NULL;
+   }
+   return glob_compile(&set->appid_globs) && glob_compile(&set->title_globs);
+}
+
+//------------------------------------------------------------------------
+static struct simple_output*
+get_output_by_name(const char *name)
+{
+   struct simple_output *output;
+   wl_list_for_each(output, &g_server->outputs, link)
+      if(!strcmp(output->wlr_output->name, name)) return output;
+   return NULL;
+}
+
+static bool
+apply_rule(struct window_rule *rule, struct simple_client *client)
+{
+   bool placed = false;
+   struct simple_output *output;
+
+   if(rule->output[0] && (output = get_output_by_name(rule->output)))
+      client->output = output;
+   if(rule->tag>0 && rule->tag<=g_config->n_tags)
+      client->tag = TAGMASK(rule->tag-1);
+   if(rule->fixed>=0)   client->fixed = rule->fixed;
+   if(rule->visible>=0) client->visible = rule->visible;
+   if(rule->suspend>=0) client->suspend_hidden = rule->suspend;
+
+   if(rule->has_size) {
+      client->geom.width = rule->width;
+      client->geom.height = rule->height;
+   }
+   if(rule->has_position) {
+      client->geom.x = client->output->usable_area.x + rule->x;
+      client->geom.y = client->output->usable_area.y + rule->y;
+      placed = true;
+   }
+   return placed;
+}
+
+bool
+apply_client_rules(struct simple_client *client)
+{
+   struct rule_set *set = g_config->rules;
+   if(!set || set->n_rules==0 || client->type==XWL_UNMANAGED_CLIENT) return false;
+
+   const char *appid = get_client_appid(client);
+   const char *title = get_client_title(client);
+   if(!appid) appid = "";
+   if(!title) title = "";
+
+   memcpy(set->appid_match, set->appid_default, set->n_words * sizeof(uint64_t));
+   memcpy(set->title_match, set->title_default, set->n_words * sizeof(uint64_t));
+   if(!glob_match(&set->appid_globs, appid, set->appid_match) || !glob_match(&set->title_globs, title, set->title_match))
+      say(WARNING, "Cannot allocate window rules, glob patterns are skipped");
+
+   // rules in config order whose globs matched both fields
+   bool placed = false;
+   for(int w=0; w<set->n_words; w++)
+      for(uint64_t bits = set->appid_match[w] & set->title_match[w]; bits; bits &= bits-1) {
+         struct window_rule *rule = &set->rules[w*64 + __builtin_ctzll(bits)];
+         if(!pattern_regex_matches(&rule->appid, appid) || !pattern_regex_matches(&rule->title, title)) continue;
+
+         placed |= apply_rule(rule, client);
+      }
+   return placed;
+}
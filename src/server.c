@@ -1,4 +1,7 @@
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
 #include <signal.h>
 #include <string.h>
 #include <wlr/backend.h>
@@ -45,20 +48,27 @@
 #include "server.h"
 #include "input.h"
 #include "ipc.h"
+#include "spatial.h"
+#include "log.h"
+#include "trace.h"
+#include "stats.h"
+#include "metrics.h"
+#include "alloc.h"
+#include "budget.h"
 
 //--- client outline procedures ------------------------------------------
 static void
 client_outline_destroy_notify(struct wl_listener *listener, void *data)
 {
    struct client_outline* outline = wl_container_of(listener, outline, destroy);
-   wl_list_remove(&outline->destroy.link);
-   free(outline);
+   UNLISTEN(&outline->destroy);
+   alloc_free(outline);
 }
 
 struct client_outline*
 client_outline_create(struct wlr_scene_tree *parent, float* border_colour, int line_width)
 {
-   struct client_outline* outline = calloc(1, sizeof(struct client_outline));
+   struct client_outline* outline = alloc_calloc(ALLOC_CLIENT, 1, sizeof(struct client_outline));
    outline->line_width = line_width;
    outline->tree = wlr_scene_tree_create(parent);
 
@@ -164,6 +174,8 @@ print_server_info()
 
    wl_list_for_each(output, &g_server->outputs, link) {
       ipc_output_printstatus(output);
+      if(!LOG_ENABLED(DEBUG)) continue;
+
       say(DEBUG, "output %s", output->wlr_output->name);
       say(DEBUG, " -> cur_output = %u", output == g_server->cur_output);
       say(DEBUG, " -> tag = vis:%u / cur:%u", output->visible_tags, output->current_tag);
@@ -205,16 +217,29 @@ arrange_output(struct simple_output* output)
 {
    say(DEBUG, "arrange_output");
    struct simple_client* client, *focused_client=NULL;
+   uint64_t start_ns = trace_begin("arrange_output");
 
    get_client_from_surface(g_server->seat->keyboard_state.focused_surface, &focused_client, NULL);
    
+   // a visible fullscreen client is the only thing composited on its output
+   struct simple_client* fs_client = output->fullscreen_client;
+   bool fs_shown = fs_client && fs_client->visible && VISIBLEON(fs_client, output);
+
    int n=0;
    wl_list_for_each(client, &g_server->clients, link) {
-      if(client->visible && VISIBLEON(client, output)) n++;
+      bool shown = client->visible && VISIBLEON(client, output) && (!fs_shown || client==fs_client);
+      if(shown) n++;
       set_client_border_colour(client, client==focused_client ? FOCUSED : UNFOCUSED);
-      wlr_scene_node_set_enabled(&client->scene_tree->node, client->visible && VISIBLEON(client, output));
+      wlr_scene_node_set_enabled(&client->scene_tree->node, shown);
+      if(client->suspend_hidden)
+         set_client_suspended(client, !shown);
    }
 
+   set_layers_enabled(output, !fs_shown);
+   wlr_scene_node_set_enabled(&g_server->root_bg->node, !(fs_shown && wl_list_length(&g_server->outputs)==1));
+   if(fs_shown)
+      focused_client = fs_client;
+
    if(n>0){
       if(!focused_client)
          focused_client = get_top_client_from_output(output, false);
@@ -223,6 +248,7 @@ arrange_output(struct simple_output* output)
       input_focus_surface(NULL);
 
    check_idle_inhibitor();
+   trace_end("arrange_output", start_ns);
 }
 
 //--- Other notify functions ---------------------------------------------
@@ -319,6 +345,135 @@ urgent_notify(struct wl_listener *listener, void *data)
    client->urgent = true;
 }
 
+static void
+startup_line(const char *line, void *data)
+{
+   say(DEBUG, "%s", line);
+}
+
+static void
+new_surface_notify(struct wl_listener *listener, void *data)
+{
+   budget_new_surface(data);
+}
+
+//------------------------------------------------------------------------
+// Clients see a global only if it is on, or privileged and the client's
+// executable is listed in privileged_clients. The answer for the client last
+// asked about is kept, a client is filtered once per global on connect.
+static struct {
+   const struct wl_client *client;
+   bool privileged;
+   struct wl_listener destroy;
+} privileged_cache;
+
+static void
+privileged_client_destroy_notify(struct wl_listener *listener, void *data)
+{
+   wl_list_remove(&listener->link);
+   privileged_cache.client = NULL;
+}
+
+static bool
+match_privileged_client(const char *exe)
+{
+   char list[sizeof g_config->privileged_clients], *saveptr;
+   const char *base = strrchr(exe, '/');
+   base = base ? base+1 : exe;
+
+   // entries with a slash match the full path, others the executable's name
+   strcpy(list, g_config->privileged_clients);
+   for(char *entry = strtok_r(list, " ", &saveptr); entry; entry = strtok_r(NULL, " ", &saveptr))
+      if(!strcmp(entry, strchr(entry, '/') ? exe : base)) return true;
+   return false;
+}
+
+static bool
+is_privileged_client(const struct wl_client *client)
+{
+   if(privileged_cache.client == client) return privileged_cache.privileged;
+   global_filter_reset();
+
+   pid_t pid;
+   char path[32], exe[PATH_MAX];
+   wl_client_get_credentials((struct wl_client*)client, &pid, NULL, NULL);
+   snprintf(path, sizeof path, "/proc/%d/exe", pid);
+
+   ssize_t len = readlink(path, exe, sizeof exe - 1);
+   bool privileged = false;
+   if(len>0) {
+      exe[len] = '\0';
+      privileged = match_privileged_client(exe);
+   }
+   say(DEBUG, "Client pid %d (%s) is %sprivileged", pid, len>0 ? exe : "?", privileged ? "" : "not ");
+
+   privileged_cache.client = client;
+   privileged_cache.privileged = privileged;
+   privileged_cache.destroy.notify = privileged_client_destroy_notify;
+   wl_client_add_destroy_listener((struct wl_client*)client, &privileged_cache.destroy);
+   return privileged;
+}
+
+static bool
+global_filter(const struct wl_client *client, const struct wl_global *global, void *data)
+{
+   for(int i=0; i<NGLOBALS; i++) {
+      if(g_server->optional_globals[i] != global) continue;
+      return g_config->global_access[i]!=ACCESS_PRIVILEGED || is_privileged_client(client);
+   }
+   return true;
+}
+
+// forget the cached answer, after privileged_clients or an access mode changed
+void
+global_filter_reset()
+{
+   if(!privileged_cache.client) return;
+   wl_list_remove(&privileged_cache.destroy.link);
+   privileged_cache.client = NULL;
+}
+
+static bool
+global_enabled(enum OptionalGlobal global)
+{
+   return g_config->global_access[global] != ACCESS_OFF;
+}
+
+// screen capture, clipboard managers and gamma are only used once the session is up
+static void
+deferred_init(void *data)
+{
+   if(global_enabled(GLOBAL_EXPORT_DMABUF))
+      g_server->optional_globals[GLOBAL_EXPORT_DMABUF] = wlr_export_dmabuf_manager_v1_create(g_server->display)->global;
+   if(global_enabled(GLOBAL_SCREENCOPY))
+      g_server->optional_globals[GLOBAL_SCREENCOPY] = wlr_screencopy_manager_v1_create(g_server->display)->global;
+   if(global_enabled(GLOBAL_DATA_CONTROL))
+      g_server->optional_globals[GLOBAL_DATA_CONTROL] = wlr_data_control_manager_v1_create(g_server->display)->global;
+
+   if(global_enabled(GLOBAL_GAMMA_CONTROL)) {
+      g_server->gamma_control_manager = wlr_gamma_control_manager_v1_create(g_server->display);
+      g_server->optional_globals[GLOBAL_GAMMA_CONTROL] = g_server->gamma_control_manager->global;
+      LISTEN(&g_server->gamma_control_manager->events.set_gamma, &g_server->set_gamma, set_gamma_notify);
+   }
+
+   startup_mark("deferred globals");
+   if(LOG_ENABLED(DEBUG))
+      startup_report(startup_line, NULL);
+}
+
+static void
+dump_log_line(const char *line, void *data)
+{
+   fprintf(stderr, "%s\n", line);
+}
+
+static int
+dump_log_notify(int signal, void *data)
+{
+   log_ring_dump(dump_log_line, NULL);
+   return 0;
+}
+
 //--- Lock session notify functions --------------------------------------
 static void
 lock_surface_destroy_notify(struct wl_listener *listener, void *data)
@@ -328,7 +483,7 @@ lock_surface_destroy_notify(struct wl_listener *listener, void *data)
    struct wlr_session_lock_surface_v1 *lock_surface = output->lock_surface;
 
    output->lock_surface = NULL;
-   wl_list_remove(&output->lock_surface_destroy.link);
+   UNLISTEN(&output->lock_surface_destroy);
 
    if(lock_surface->surface != g_server->seat->keyboard_state.focused_surface)
       return;
@@ -384,9 +539,9 @@ lock_session_destroy_notify(struct wl_listener *listener, void *data)
 
    wlr_seat_keyboard_notify_clear_focus(g_server->seat);
 
-   wl_list_remove(&slock->new_surface.link);
-   wl_list_remove(&slock->unlock.link);
-   wl_list_remove(&slock->destroy.link);
+   UNLISTEN(&slock->new_surface);
+   UNLISTEN(&slock->unlock);
+   UNLISTEN(&slock->destroy);
 
    wlr_scene_node_destroy(&slock->scene->node);
    g_server->cur_lock = NULL;
@@ -398,8 +553,8 @@ lock_session_manager_destroy_notify(struct wl_listener *listener, void *data)
 {
    say(DEBUG, "lock_session_manager_destroy_notify");
 
-   wl_list_remove(&g_server->new_lock_session_manager.link);
-   wl_list_remove(&g_server->lock_session_manager_destroy.link);
+   UNLISTEN(&g_server->new_lock_session_manager);
+   UNLISTEN(&g_server->lock_session_manager_destroy);
 }
 
 static void
@@ -454,6 +609,7 @@ output_layout_change_notify(struct wl_listener *listener, void *data)
 
       memset(&output->usable_area, 0, sizeof(output->usable_area));
       output->usable_area = box;
+      spatial_grid_rebuild(output, &box);
 
       output->gamma_lut_changed = true;
       config_head->state.x = box.x;
@@ -486,10 +642,11 @@ output_frame_notify(struct wl_listener *listener, void *data)
    //say(DEBUG, "output_frame_notify");
    struct simple_output *output = wl_container_of(listener, output, frame);
    struct wlr_scene_output *scene_output = wlr_scene_get_scene_output(g_server->scene, output->wlr_output);
+   uint64_t start_ns = stats_now();
    
    struct wlr_gamma_control_v1 *gamma_control;
    struct wlr_output_state pending = {0};
-   if (output->gamma_lut_changed) {
+   if (output->gamma_lut_changed && g_server->gamma_control_manager) {
       say(DEBUG, "gamma_lut_changed true");
       gamma_control = wlr_gamma_control_manager_v1_get_control(g_server->gamma_control_manager, output->wlr_output);
       output->gamma_lut_changed = false;
@@ -511,6 +668,18 @@ output_frame_notify(struct wl_listener *listener, void *data)
    struct timespec now;
    clock_gettime(CLOCK_MONOTONIC, &now);
    wlr_scene_output_send_frame_done(scene_output, &now);
+   output->last_frame_ns = (uint64_t)now.tv_sec*1000000000 + now.tv_nsec;
+   g_server->counters.frames++;
+   g_server->counters.frame_ns += output->last_frame_ns - start_ns;
+
+   // status changed since the last event loop iteration goes out with the frame
+   ipc_flush_status();
+
+   if(!g_server->first_frame_done) {
+      g_server->first_frame_done = true;
+      startup_mark("first frame");
+      wl_event_loop_add_idle(g_server->event_loop, deferred_init, NULL);
+   }
 }
 
 static void 
@@ -533,9 +702,14 @@ output_destroy_notify(struct wl_listener *listener, void *data)
    wl_list_for_each_safe(ipc_output, ipc_output_tmp, &output->ipc_outputs, link)
       wl_resource_destroy(ipc_output->resource);
 
-   wl_list_remove(&output->frame.link);
-   wl_list_remove(&output->request_state.link);
-   wl_list_remove(&output->destroy.link);
+   struct simple_client *client;
+   wl_list_for_each(client, &g_server->clients, link)
+      if(client->grid_output == output) client->grid_output = NULL;
+   spatial_grid_destroy(output->grid);
+
+   UNLISTEN(&output->frame);
+   UNLISTEN(&output->request_state);
+   UNLISTEN(&output->destroy);
    wl_list_remove(&output->link);
    free(output);
 }
@@ -601,6 +775,10 @@ new_output_notify(struct wl_listener *listener, void *data)
       wlr_scene_output_create(g_server->scene, wlr_output);
    wlr_scene_output_layout_add_output(g_server->scene_output_layout, l_output, scene_output);
 
+   struct wlr_box output_box;
+   wlr_output_layout_get_box(g_server->output_layout, wlr_output, &output_box);
+   spatial_grid_rebuild(output, &output_box);
+
    // update background and lock geometry
    struct wlr_box geom;
    wlr_output_layout_get_box(g_server->output_layout, NULL, &geom);
@@ -628,9 +806,16 @@ prepareServer()
    
    g_server->display = wl_display_create();
    g_server->event_loop = wl_display_get_event_loop(g_server->display);
+   if(!(g_server->input_loop = wl_event_loop_create()))
+      say(ERROR, "Unable to create input event loop");
 
-   if(!(g_server->backend = wlr_backend_autocreate(g_server->event_loop, &g_session)))
+   // SIGUSR1 dumps the recent messages, handled from the event loop
+   wl_event_loop_add_signal(g_server->event_loop, SIGUSR1, dump_log_notify, NULL);
+
+   // the backend's fds (libinput, DRM, session) go on their own loop, see runServer()
+   if(!(g_server->backend = wlr_backend_autocreate(g_server->input_loop, &g_session)))
       say(ERROR, "Unable to create wlr_backend!");
+   startup_mark("backend");
 
    // create a scene graph used to lay out windows
    /* 
@@ -656,15 +841,14 @@ prepareServer()
    // create an allocator
    if(!(g_server->allocator = wlr_allocator_autocreate(g_server->backend, g_server->renderer)))
       say(ERROR, "Unable to create wlr_allocator");
+   startup_mark("renderer");
 
    // create compositor
    g_server->compositor = wlr_compositor_create(g_server->display, COMPOSITOR_VERSION, g_server->renderer);
+   LISTEN(&g_server->compositor->events.new_surface, &g_server->new_surface, new_surface_notify);
    wlr_subcompositor_create(g_server->display);
    wlr_data_device_manager_create(g_server->display);
    
-   wlr_export_dmabuf_manager_v1_create(g_server->display);
-   wlr_screencopy_manager_v1_create(g_server->display);
-   wlr_data_control_manager_v1_create(g_server->display);
    wlr_viewporter_create(g_server->display);
    wlr_single_pixel_buffer_manager_v1_create(g_server->display);
    wlr_primary_selection_v1_device_manager_create(g_server->display);
@@ -674,10 +858,6 @@ prepareServer()
    g_server->xdg_activation = wlr_xdg_activation_v1_create(g_server->display);
    LISTEN(&g_server->xdg_activation->events.request_activate, &g_server->request_activate, urgent_notify);
 
-   // gamma control manager
-   g_server->gamma_control_manager = wlr_gamma_control_manager_v1_create(g_server->display);
-   LISTEN(&g_server->gamma_control_manager->events.set_gamma, &g_server->set_gamma, set_gamma_notify);
-
    // create an output layout, i.e. wlroots utility for working with an arrangement of 
    // screens in a physical layout
    g_server->output_layout = wlr_output_layout_create(g_server->display);
@@ -699,6 +879,7 @@ prepareServer()
       say(ERROR, "cannot allocate seat");
 
    input_init();
+   startup_mark("seat");
 
    // set up Wayland shells, i.e. XDG, layer shell and XWayland
    wl_list_init(&g_server->clients);
@@ -722,8 +903,11 @@ prepareServer()
    LISTEN(&g_server->session_lock_manager->events.destroy, &g_server->lock_session_manager_destroy, lock_session_manager_destroy_notify);
 
    // set up output power manager
-   g_server->output_power_manager = wlr_output_power_manager_v1_create(g_server->display);
-   LISTEN(&g_server->output_power_manager->events.set_mode, &g_server->output_pm_set_mode, output_pm_set_mode_notify);
+   if(global_enabled(GLOBAL_OUTPUT_POWER)) {
+      g_server->output_power_manager = wlr_output_power_manager_v1_create(g_server->display);
+      g_server->optional_globals[GLOBAL_OUTPUT_POWER] = g_server->output_power_manager->global;
+      LISTEN(&g_server->output_power_manager->events.set_mode, &g_server->output_pm_set_mode, output_pm_set_mode_notify);
+   }
 
    // set initial size - will be updated when output is changed
    g_server->locked_bg = wlr_scene_rect_create(g_server->layer_tree[LyrLock], 1, 1, (float [4]){0.1, 0.1, 0.1, 1.0});
@@ -742,16 +926,35 @@ prepareServer()
    wlr_presentation_create(g_server->display, g_server->backend);
 
    // Set up IPC interface
-   wl_global_create(g_server->display, &zdwl_ipc_manager_v2_interface, DWL_IPC_VERSION, NULL, ipc_manager_bind);
+   if(global_enabled(GLOBAL_IPC))
+      g_server->optional_globals[GLOBAL_IPC] = wl_global_create(g_server->display, &zdwl_ipc_manager_v2_interface,
+            DWL_IPC_VERSION, NULL, ipc_manager_bind);
+   wl_display_set_global_filter(g_server->display, global_filter, NULL);
+   startup_mark("globals");
 
 #if XWAYLAND
-   if(!(g_server->xwayland = wlr_xwayland_create(g_server->display, g_server->compositor, true))) {
+   // Xwayland is started on the first X11 connection and exits by itself once it
+   // has had no clients for xwayland_idle_timeout seconds. The listening sockets,
+   // and so DISPLAY, stay with us; the next connection starts it again.
+   struct wlr_xwayland_server_options xwl_options = {
+      .lazy = true,
+      .enable_wm = true,
+      .terminate_delay = g_config->xwayland_idle_timeout,
+   };
+   if(!(g_server->xwayland_server = wlr_xwayland_server_create(g_server->display, &xwl_options))) {
       say(WARNING, "unable to create xwayland server. Continuing without it");
       return;
    }
+   if(!(g_server->xwayland = wlr_xwayland_create_with_server(g_server->display, g_server->compositor, g_server->xwayland_server))) {
+      say(WARNING, "unable to create xwayland server. Continuing without it");
+      wlr_xwayland_server_destroy(g_server->xwayland_server);
+      g_server->xwayland_server = NULL;
+      return;
+   }
 
    LISTEN(&g_server->xwayland->events.new_surface, &g_server->xwl_new_surface, xwl_new_surface_notify);
    LISTEN(&g_server->xwayland->events.ready, &g_server->xwl_ready, xwl_ready_notify);
+   startup_mark("xwayland");
 #endif
 }
 
@@ -770,23 +973,76 @@ startServer(char* start_cmd)
       cleanupServer(g_server);
       say(ERROR, "Unable to start WLR backend!");
    }
+   startup_mark("backend started");
    
    setenv("WAYLAND_DISPLAY", socket, true);
    say(INFO, " -> Wayland server is running on WAYLAND_DISPLAY=%s ...", socket);
 
 #if XWAYLAND
-   if(setenv("DISPLAY", g_server->xwayland->display_name, true) < 0)
+   if(!g_server->xwayland)
+      say(INFO, " -> XWayland is not available");
+   else if(setenv("DISPLAY", g_server->xwayland->display_name, true) < 0)
       say(WARNING, " -> Unable to set DISPLAY for xwayland");
    else 
       say(INFO, " -> XWayland is running on display %s", g_server->xwayland->display_name);
 #endif
 
+   start_ping_timer();
+   metrics_start(g_config->metrics_socket);
+   config_watch_update();
+
    // choose initial output based on cursor position
    g_server->cur_output = get_output_at(g_server->cursor->x, g_server->cursor->y);
 
    // Run autostarts and startup comand if defined
    if(start_cmd[0]!='\0') spawn(start_cmd);
    if(g_config->autostart_script[0]!='\0') spawn(g_config->autostart_script);
+   startup_mark("autostart");
+}
+
+// Replaces wl_display_run() so input is never queued behind clients. Each
+// iteration dispatches the input loop first, then the display's loop (clients,
+// timers, signals, IPC) in batches until nothing is pending, input is waiting
+// or dispatch_budget_us is used up.
+void
+runServer()
+{
+   struct pollfd fds[] = {
+      { wl_event_loop_get_fd(g_server->input_loop), POLLIN, 0 },
+      { wl_event_loop_get_fd(g_server->event_loop), POLLIN, 0 },
+   };
+
+   g_server->running = true;
+   while(g_server->running) {
+      // an idle source on either loop may have been added by the other one
+      trace_dispatch_begin("idle");
+      wl_event_loop_dispatch_idle(g_server->input_loop);
+      wl_event_loop_dispatch_idle(g_server->event_loop);
+      wl_event_loop_dispatch_idle(g_server->input_loop);
+      wl_display_flush_clients(g_server->display);
+      trace_dispatch_end();
+
+      if(poll(fds, LENGTH(fds), -1) < 0) {
+         if(errno==EINTR) continue;
+         say(WARNING, "Event loop poll failed: %s", strerror(errno));
+         break;
+      }
+      if(fds[0].revents) {
+         trace_dispatch_begin("input");
+         wl_event_loop_dispatch(g_server->input_loop, 0);
+         trace_dispatch_end();
+      }
+      if(!fds[1].revents) continue;
+
+      uint64_t deadline = stats_now() + (uint64_t)g_config->dispatch_budget_us*1000;
+      while(g_server->running) {
+         trace_dispatch_begin("event");
+         wl_event_loop_dispatch(g_server->event_loop, 0);
+         trace_dispatch_end();
+         if(stats_now() >= deadline) break;
+         if(poll(fds, LENGTH(fds), 0) <= 0 || fds[0].revents || !fds[1].revents) break;
+      }
+   }
 }
 
 void 
@@ -794,16 +1050,36 @@ cleanupServer()
 {
    say(INFO, "Cleaning up Wayland server");
 
+   metrics_finish();
+   config_watch_finish();
+
 #if XWAYLAND
-   g_server->xwayland = NULL;
-   wlr_xwayland_destroy(g_server->xwayland);
+   // the server is ours, wlr_xwayland_destroy() leaves it alone
+   if(g_server->xwayland) {
+      UNLISTEN(&g_server->xwl_new_surface);
+      UNLISTEN(&g_server->xwl_ready);
+      wlr_xwayland_destroy(g_server->xwayland);
+      g_server->xwayland = NULL;
+   }
+   if(g_server->xwayland_server) {
+      wlr_xwayland_server_destroy(g_server->xwayland_server);
+      g_server->xwayland_server = NULL;
+   }
 #endif
 
    wl_display_destroy_clients(g_server->display);
+   // the backend is not on the display's loop, so it is not destroyed with it
+   wlr_backend_destroy(g_server->backend);
    wlr_xcursor_manager_destroy(g_server->cursor_manager);
    wlr_output_layout_destroy(g_server->output_layout);
    wl_display_destroy(g_server->display);
    // Destroy after the wayland display
    wlr_scene_node_destroy(&g_server->scene->tree.node);
+   // and the session with the input loop
+   wl_event_loop_destroy(g_server->input_loop);
+
+   alloc_free(g_server->snap.x);
+   alloc_free(g_server->snap.y);
+   g_server->snap = (struct snap_edges){ 0 };
 }
 
@@ -0,0 +1,272 @@
+#include <limits.h>
+#include <string.h>
+#include <wlr/backend/session.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/box.h>
+
+#include "globals.h"
+#include "layer.h"
+#include "client.h"
+#include "server.h"
+#include "spatial.h"
+#include "alloc.h"
+
+// stamp used to visit each client once per query, even if it spans several cells
+static unsigned int query_stamp;
+
+static int
+clamp_index(int value, int max)
+{
+   return value < 0 ? 0 : (value >= max ? max - 1 : value);
+}
+
+static int
+cell_col(struct spatial_grid *grid, int x)
+{
+   int offset = x - grid->area.x;
+   return clamp_index(offset < 0 ? -1 : offset/SPATIAL_CELL_SIZE, grid->cols);
+}
+
+static int
+cell_row(struct spatial_grid *grid, int y)
+{
+   int offset = y - grid->area.y;
+   return clamp_index(offset < 0 ? -1 : offset/SPATIAL_CELL_SIZE, grid->rows);
+}
+
+static void
+get_bordered_box(struct simple_client *client, struct wlr_box *box)
+{
+   int bw = g_config->border_width;
+
+   box->x = client->geom.x - bw;
+   box->y = client->geom.y - bw;
+   box->width = client->geom.width + 2*bw;
+   box->height = client->geom.height + 2*bw;
+}
+
+static void
+cell_add(struct spatial_cell *cell, struct simple_client *client)
+{
+   if(cell->n == cell->capacity) {
+      cell->capacity = cell->capacity ? cell->capacity*2 : 4;
+      cell->clients = alloc_realloc(ALLOC_LAYOUT, cell->clients, cell->capacity * sizeof(struct simple_client*));
+      if(!cell->clients)
+         say(ERROR, "Cannot allocate spatial grid cell");
+   }
+   cell->clients[cell->n++] = client;
+}
+
+static void
+cell_del(struct spatial_cell *cell, struct simple_client *client)
+{
+   for(int i=0; i<cell->n; i++) {
+      if(cell->clients[i] != client) continue;
+      cell->clients[i] = cell->clients[--cell->n];
+      return;
+   }
+}
+
+static bool
+is_candidate(struct simple_client *client, struct simple_output *output)
+{
+   if(client->grid_stamp == query_stamp) return false;
+   client->grid_stamp = query_stamp;
+   return client->visible && VISIBLEON(client, output);
+}
+
+//------------------------------------------------------------------------
+struct spatial_grid*
+spatial_grid_create(struct wlr_box *area)
+{
+   struct spatial_grid *grid = alloc_calloc(ALLOC_LAYOUT, 1, sizeof(struct spatial_grid));
+   if(!grid)
+      say(ERROR, "Cannot allocate spatial grid");
+
+   grid->area = *area;
+   grid->cols = MAX(1, (area->width + SPATIAL_CELL_SIZE - 1)/SPATIAL_CELL_SIZE);
+   grid->rows = MAX(1, (area->height + SPATIAL_CELL_SIZE - 1)/SPATIAL_CELL_SIZE);
+   if(!(grid->cells = alloc_calloc(ALLOC_LAYOUT, grid->cols * grid->rows, sizeof(struct spatial_cell))))
+      say(ERROR, "Cannot allocate spatial grid cells");
+
+   return grid;
+}
+
+void
+spatial_grid_destroy(struct spatial_grid *grid)
+{
+   if(!grid) return;
+
+   for(int i=0; i<grid->cols*grid->rows; i++)
+      alloc_free(grid->cells[i].clients);
+   alloc_free(grid->cells);
+   alloc_free(grid);
+}
+
+void
+spatial_grid_rebuild(struct simple_output *output, struct wlr_box *area)
+{
+   struct simple_client *client;
+   if(output->grid && wlr_box_equal(&output->grid->area, area)) return;
+
+   spatial_grid_destroy(output->grid);
+   output->grid = spatial_grid_create(area);
+
+   wl_list_for_each(client, &g_server->clients, link) {
+      if(client->grid_output != output) continue;
+      client->grid_output = NULL;
+      spatial_update_client(client);
+   }
+}
+
+void
+spatial_remove_client(struct simple_client *client)
+{
+   struct spatial_grid *grid;
+   if(!client->grid_output || !(grid = client->grid_output->grid)) {
+      client->grid_output = NULL;
+      return;
+   }
+
+   struct wlr_box *box = &client->grid_box;
+   int c0 = cell_col(grid, box->x), c1 = cell_col(grid, box->x + box->width - 1);
+   int r0 = cell_row(grid, box->y), r1 = cell_row(grid, box->y + box->height - 1);
+   for(int r=r0; r<=r1; r++)
+      for(int c=c0; c<=c1; c++)
+         cell_del(&grid->cells[r*grid->cols + c], client);
+
+   client->grid_output = NULL;
+}
+
+void
+spatial_update_client(struct simple_client *client)
+{
+   if(!client->mapped || client->type==XWL_UNMANAGED_CLIENT) return;
+
+   struct simple_output *output = client->output;
+   struct wlr_box box;
+   get_bordered_box(client, &box);
+
+   if(client->grid_output == output && wlr_box_equal(&client->grid_box, &box)) return;
+   spatial_remove_client(client);
+
+   struct spatial_grid *grid = output ? output->grid : NULL;
+   if(!grid || wlr_box_empty(&box)) return;
+
+   int c0 = cell_col(grid, box.x), c1 = cell_col(grid, box.x + box.width - 1);
+   int r0 = cell_row(grid, box.y), r1 = cell_row(grid, box.y + box.height - 1);
+   for(int r=r0; r<=r1; r++)
+      for(int c=c0; c<=c1; c++)
+         cell_add(&grid->cells[r*grid->cols + c], client);
+
+   client->grid_box = box;
+   client->grid_output = output;
+}
+
+//------------------------------------------------------------------------
+static long
+direction_cost(struct simple_client *from, struct simple_client *to, enum Direction direction)
+{
+   int dx = (to->geom.x + to->geom.width/2) - (from->geom.x + from->geom.width/2);
+   int dy = (to->geom.y + to->geom.height/2) - (from->geom.y + from->geom.height/2);
+   long primary, secondary;
+
+   switch(direction) {
+      case LEFT:  primary = -dx; secondary = abs(dy); break;
+      case RIGHT: primary = dx;  secondary = abs(dy); break;
+      case UP:    primary = -dy; secondary = abs(dx); break;
+      case DOWN:  primary = dy;  secondary = abs(dx); break;
+      default:    return -1;
+   }
+   if(primary <= 0) return -1;
+
+   // off-axis distance weighs double, so the nearest window in line wins
+   return primary + 2*secondary;
+}
+
+static bool
+cell_in_direction(int dc, int dr, enum Direction direction)
+{
+   switch(direction) {
+      case LEFT:  return dc <= 0;
+      case RIGHT: return dc >= 0;
+      case UP:    return dr <= 0;
+      case DOWN:  return dr >= 0;
+   }
+   return false;
+}
+
+struct simple_client*
+spatial_client_in_direction(struct simple_client *from, enum Direction direction)
+{
+   struct simple_output *output = from->output;
+   struct spatial_grid *grid = output ? output->grid : NULL;
+   if(!grid) return NULL;
+
+   struct simple_client *best = NULL;
+   long best_cost = LONG_MAX;
+
+   query_stamp++;
+   from->grid_stamp = query_stamp;
+
+   int col = cell_col(grid, from->geom.x + from->geom.width/2);
+   int row = cell_row(grid, from->geom.y + from->geom.height/2);
+   int max_ring = MAX(grid->cols, grid->rows);
+
+   // walk rings of cells outwards; a window first seen in ring r is at least
+   // (r-1) cells away, so stop once that bound exceeds the best cost found
+   for(int ring=0; ring<max_ring; ring++) {
+      if(best && (long)(ring-1)*SPATIAL_CELL_SIZE > best_cost) break;
+
+      for(int dr=-ring; dr<=ring; dr++) {
+         int step = (dr==-ring || dr==ring) ? 1 : 2*ring;
+         for(int dc=-ring; dc<=ring; dc+=step) {
+            int r = row + dr, c = col + dc;
+            if(r<0 || r>=grid->rows || c<0 || c>=grid->cols) continue;
+            if(!cell_in_direction(dc, dr, direction)) continue;
+
+            struct spatial_cell *cell = &grid->cells[r*grid->cols + c];
+            for(int i=0; i<cell->n; i++) {
+               struct simple_client *client = cell->clients[i];
+               if(!is_candidate(client, output)) continue;
+
+               long cost = direction_cost(from, client, direction);
+               if(cost >= 0 && cost < best_cost) {
+                  best_cost = cost;
+                  best = client;
+               }
+            }
+         }
+      }
+   }
+   return best;
+}
+
+long
+spatial_overlap_area(struct simple_output *output, struct wlr_box *box, struct simple_client *exclude)
+{
+   struct spatial_grid *grid = output ? output->grid : NULL;
+   if(!grid || wlr_box_empty(box)) return 0;
+
+   long area = 0;
+   struct wlr_box intersection;
+
+   query_stamp++;
+   if(exclude) exclude->grid_stamp = query_stamp;
+
+   int c0 = cell_col(grid, box->x), c1 = cell_col(grid, box->x + box->width - 1);
+   int r0 = cell_row(grid, box->y), r1 = cell_row(grid, box->y + box->height - 1);
+   for(int r=r0; r<=r1; r++) {
+      for(int c=c0; c<=c1; c++) {
+         struct spatial_cell *cell = &grid->cells[r*grid->cols + c];
+         for(int i=0; i<cell->n; i++) {
+            struct simple_client *client = cell->clients[i];
+            if(!is_candidate(client, output)) continue;
+
+            if(wlr_box_intersection(&intersection, &client->grid_box, box))
+               area += (long)intersection.width * intersection.height;
+         }
+      }
+   }
+   return area;
+}
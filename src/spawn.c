@@ -0,0 +1,384 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "globals.h"
+
+#define CHILD_HISTORY   8
+#define SPAWN_MSG_SIZE  65536
+#define SPAWN_MAX_ENV   1024
+
+extern char **environ;
+
+enum SpawnReply { SPAWN_STARTED, SPAWN_EXITED };
+
+// helper to compositor; a request is the command and the environment, NUL separated
+struct spawn_reply {
+   enum SpawnReply type;
+   pid_t pid;
+   int status;       // errno if the spawn failed, wait status once exited
+};
+
+struct child {
+   pid_t pid;
+   bool direct;      // forked by the compositor itself, not the helper
+   char cmd[64];
+   int status;
+   struct wl_list link;
+};
+
+// spawned processes still running, requests the helper has not answered yet,
+// and the last few that exited
+static struct wl_list children = { &children, &children };
+static struct wl_list pending = { &pending, &pending };
+static struct child exited[CHILD_HISTORY];
+static unsigned int n_exited;
+
+static struct {
+   pid_t pid;
+   int fd;
+   struct wl_event_source *source;
+} helper = { .fd = -1 };
+
+//------------------------------------------------------------------------
+static void
+close_other_fds(int keep)
+{
+   DIR *dir = opendir("/proc/self/fd");
+   if(!dir) return;
+
+   int fds[256], n = 0;
+   struct dirent *entry;
+   while((entry = readdir(dir)) && n < LENGTH(fds)) {
+      int fd = atoi(entry->d_name);
+      if(fd > STDERR_FILENO && fd != keep && fd != dirfd(dir)) fds[n++] = fd;
+   }
+   closedir(dir);
+
+   for(int i=0; i<n; i++) close(fds[i]);
+}
+
+static void
+join_cgroup(const char *cgroup)
+{
+   char path[256];
+   snprintf(path, sizeof path, "%s/cgroup.procs", cgroup);
+
+   FILE *f = fopen(path, "w");
+   if(!f || fprintf(f, "%d\n", getpid()) < 0 || fclose(f))
+      say(WARNING, "Cannot move spawn helper into cgroup %s", cgroup);
+}
+
+static void
+helper_reply(int sock, enum SpawnReply type, pid_t pid, int status)
+{
+   struct spawn_reply reply = { type, pid, status };
+   send(sock, &reply, sizeof reply, MSG_NOSIGNAL);
+}
+
+static void
+helper_spawn(int sock, char *msg, size_t len)
+{
+   static char *envp[SPAWN_MAX_ENV];
+   char *sh = getenv("SHELL");
+   if(!sh) sh = "/bin/sh";
+
+   // cmd \0 env \0 env \0 ...
+   char *cmd = msg, *p = msg + strlen(msg) + 1;
+   int n = 0;
+   while(p < msg + len && n < SPAWN_MAX_ENV-1) {
+      envp[n++] = p;
+      p += strlen(p) + 1;
+   }
+   envp[n] = NULL;
+
+   posix_spawnattr_t attr;
+   posix_spawn_file_actions_t actions;
+   sigset_t mask, defaults;
+   sigemptyset(&mask);
+   sigemptyset(&defaults);
+   sigaddset(&defaults, SIGPIPE);
+
+   posix_spawnattr_init(&attr);
+   posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+   posix_spawnattr_setsigmask(&attr, &mask);
+   posix_spawnattr_setsigdefault(&attr, &defaults);
+   posix_spawn_file_actions_init(&actions);
+   posix_spawn_file_actions_adddup2(&actions, STDERR_FILENO, STDOUT_FILENO);
+
+   pid_t pid;
+   char *argv[] = { sh, "-c", cmd, NULL };
+   int err = posix_spawn(&pid, sh, &actions, &attr, argv, envp);
+
+   posix_spawn_file_actions_destroy(&actions);
+   posix_spawnattr_destroy(&attr);
+   helper_reply(sock, SPAWN_STARTED, err ? -1 : pid, err);
+}
+
+static void
+helper_main(int sock, const char *cgroup)
+{
+   static char msg[SPAWN_MSG_SIZE];
+
+   // dies with the compositor, and its children leave the compositor's session
+   prctl(PR_SET_PDEATHSIG, SIGKILL);
+   setsid();
+   close_other_fds(sock);
+   if(cgroup[0]) join_cgroup(cgroup);
+
+   // SIGCHLD is already blocked, inherited from the compositor
+   sigset_t set;
+   sigemptyset(&set);
+   sigaddset(&set, SIGCHLD);
+   int sfd = signalfd(-1, &set, SFD_CLOEXEC);
+
+   struct pollfd fds[] = { { sock, POLLIN, 0 }, { sfd, POLLIN, 0 } };
+   for(;;) {
+      if(poll(fds, sfd<0 ? 1 : 2, -1) < 0) {
+         if(errno==EINTR) continue;
+         break;
+      }
+
+      if(fds[1].revents & POLLIN) {
+         struct signalfd_siginfo info;
+         read(sfd, &info, sizeof info);
+
+         int status;
+         pid_t pid;
+         while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+            helper_reply(sock, SPAWN_EXITED, pid, status);
+      }
+
+      if(fds[0].revents & (POLLIN | POLLHUP)) {
+         ssize_t len = recv(sock, msg, sizeof msg - 1, 0);
+         if(len <= 0) break;
+         msg[len] = '\0';
+         helper_spawn(sock, msg, len);
+      }
+   }
+   _exit(0);
+}
+
+//------------------------------------------------------------------------
+void
+spawn_helper_start(const char *cgroup)
+{
+   int fds[2];
+   if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+      say(WARNING, "Cannot create spawn helper socket, spawning by fork");
+      return;
+   }
+
+   pid_t pid = fork();
+   if(pid==0) {
+      close(fds[0]);
+      helper_main(fds[1], cgroup);
+   }
+   close(fds[1]);
+
+   if(pid<0) {
+      say(WARNING, "Cannot fork spawn helper, spawning by fork");
+      close(fds[0]);
+      return;
+   }
+
+   helper.pid = pid;
+   helper.fd = fds[0];
+   say(DEBUG, "Spawn helper running as pid %d", pid);
+}
+
+static void
+helper_stop()
+{
+   if(helper.source) wl_event_source_remove(helper.source);
+   if(helper.fd>=0) close(helper.fd);
+   helper.source = NULL;
+   helper.fd = -1;
+
+   // requests it never answered are lost
+   struct child *child, *tmp;
+   wl_list_for_each_safe(child, tmp, &pending, link) {
+      say(WARNING, "Spawn of %s was lost", child->cmd);
+      wl_list_remove(&child->link);
+      free(child);
+   }
+}
+
+static void
+record_exit(struct child *child, int status)
+{
+   say(WIFEXITED(status) && WEXITSTATUS(status)==0 ? DEBUG : INFO,
+         "%s (pid %d) exited with status %d", child->cmd, child->pid, status);
+   child->status = status;
+   exited[n_exited++ % CHILD_HISTORY] = *child;
+   wl_list_remove(&child->link);
+   free(child);
+}
+
+static int
+helper_notify(int fd, uint32_t mask, void *data)
+{
+   struct spawn_reply reply;
+   struct child *child;
+
+   while(recv(fd, &reply, sizeof reply, MSG_DONTWAIT) == sizeof reply) {
+      if(reply.type==SPAWN_STARTED) {
+         // the helper answers in request order
+         if(wl_list_empty(&pending)) continue;
+         child = wl_container_of(pending.prev, child, link);
+         wl_list_remove(&child->link);
+
+         if(reply.pid<0) {
+            say(WARNING, "Cannot spawn %s: %s", child->cmd, strerror(reply.status));
+            free(child);
+            continue;
+         }
+         child->pid = reply.pid;
+         wl_list_insert(&children, &child->link);
+      } else {
+         wl_list_for_each(child, &children, link) {
+            if(child->direct || child->pid!=reply.pid) continue;
+            record_exit(child, reply.status);
+            break;
+         }
+      }
+   }
+
+   if(mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+      say(WARNING, "Spawn helper is gone, spawning by fork");
+      helper_stop();
+   }
+   return 0;
+}
+
+static int
+child_notify(int sig, void *data)
+{
+   struct child *child, *tmp;
+   int status;
+
+   // only our own children are reaped, Xwayland is left to wlroots
+   wl_list_for_each_safe(child, tmp, &children, link) {
+      if(child->direct && waitpid(child->pid, &status, WNOHANG) == child->pid)
+         record_exit(child, status);
+   }
+   if(helper.pid>0 && waitpid(helper.pid, &status, WNOHANG) == helper.pid) {
+      helper.pid = 0;
+      helper_stop();
+   }
+   return 0;
+}
+
+void
+spawn_listen(struct wl_event_loop *loop)
+{
+   wl_event_loop_add_signal(loop, SIGCHLD, child_notify, NULL);
+   if(helper.fd>=0)
+      helper.source = wl_event_loop_add_fd(loop, helper.fd, WL_EVENT_READABLE, helper_notify, NULL);
+}
+
+void
+spawn_helper_finish()
+{
+   helper_stop();
+   if(helper.pid>0) {
+      // closing the socket ends it
+      waitpid(helper.pid, NULL, 0);
+      helper.pid = 0;
+   }
+}
+
+//------------------------------------------------------------------------
+static bool
+spawn_by_helper(struct child *child)
+{
+   static char msg[SPAWN_MSG_SIZE];
+   size_t len = strlen(child->cmd) + 1;
+
+   if(helper.fd<0 || len > sizeof msg) return false;
+   memcpy(msg, child->cmd, len);
+
+   // the child gets the environment as it is now, not as it was when the helper started
+   for(char **env = environ; *env; env++) {
+      size_t n = strlen(*env) + 1;
+      if(len + n > sizeof msg) return false;
+      memcpy(msg + len, *env, n);
+      len += n;
+   }
+
+   if(send(helper.fd, msg, len, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)len) return false;
+   wl_list_insert(&pending, &child->link);
+   return true;
+}
+
+static bool
+spawn_by_fork(struct child *child)
+{
+   char *sh = NULL;
+   if(!(sh=getenv("SHELL"))) sh = (char*)"/bin/sh";
+
+   // from dwl:
+   pid_t pid = fork();
+   if(pid==0) {
+      // real-time scheduling is already reset by SCHED_RESET_ON_FORK, and memory
+      // locks are not inherited; signals handled through the event loop are
+      // blocked, don't pass that on
+      sigset_t set;
+      sigemptyset(&set);
+      sigprocmask(SIG_SETMASK, &set, NULL);
+      signal(SIGPIPE, SIG_DFL);
+      dup2(STDERR_FILENO, STDOUT_FILENO);
+      setsid();
+      execl(sh, sh, "-c", child->cmd, (char*) NULL);
+      _exit(127);
+   }
+   if(pid<0) return false;
+
+   child->pid = pid;
+   child->direct = true;
+   wl_list_insert(&children, &child->link);
+   return true;
+}
+
+void
+spawn(char* cmd)
+{
+   say(DEBUG, "Spawn %s", cmd);
+
+   struct child *child = calloc(1, sizeof(struct child));
+   if(!child) return;
+   strncpy(child->cmd, cmd, sizeof child->cmd - 1);
+
+   if(spawn_by_helper(child) || spawn_by_fork(child)) return;
+
+   say(WARNING, "Cannot spawn %s", cmd);
+   free(child);
+}
+
+void
+report_children(void (*emit)(const char*, void*), void *data)
+{
+   char line[128];
+   struct child *child;
+
+   wl_list_for_each(child, &children, link) {
+      snprintf(line, sizeof line, "pid %d running: %s", child->pid, child->cmd);
+      emit(line, data);
+   }
+   for(unsigned int i = n_exited > CHILD_HISTORY ? n_exited - CHILD_HISTORY : 0; i<n_exited; i++) {
+      struct child *last = &exited[i % CHILD_HISTORY];
+      if(WIFSIGNALED(last->status))
+         snprintf(line, sizeof line, "pid %d killed by signal %d: %s", last->pid, WTERMSIG(last->status), last->cmd);
+      else
+         snprintf(line, sizeof line, "pid %d exited with %d: %s", last->pid, WEXITSTATUS(last->status), last->cmd);
+      emit(line, data);
+   }
+}
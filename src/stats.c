@@ -0,0 +1,147 @@
+#include <pixman.h>
+#include <string.h>
+#include <time.h>
+#include <wlr/backend/session.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_scene.h>
+
+#include "globals.h"
+#include "layer.h"
+#include "client.h"
+#include "server.h"
+#include "stats.h"
+
+#define NS_PER_SEC 1000000000ull
+
+static const char *buffer_str[] = { "none", "shm", "dmabuf", "other" };
+
+uint64_t
+stats_now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*NS_PER_SEC + ts.tv_nsec;
+}
+
+static enum BufferType
+get_buffer_type(struct wlr_buffer *buffer)
+{
+   struct wlr_dmabuf_attributes dmabuf;
+   struct wlr_shm_attributes shm;
+
+   if(!buffer)                               return BUFFER_NONE;
+   if(wlr_buffer_get_dmabuf(buffer, &dmabuf)) return BUFFER_DMABUF;
+   if(wlr_buffer_get_shm(buffer, &shm))       return BUFFER_SHM;
+   return BUFFER_OTHER;
+}
+
+static uint64_t
+region_area(pixman_region32_t *region)
+{
+   int n;
+   uint64_t area = 0;
+   pixman_box32_t *rects = pixman_region32_rectangles(region, &n);
+
+   for(int i=0; i<n; i++)
+      area += (uint64_t)(rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1);
+   return area;
+}
+
+//------------------------------------------------------------------------
+void
+surface_stats_commit(struct surface_stats *stats, struct wlr_surface *surface, struct simple_output *output)
+{
+   uint64_t now = stats_now();
+
+   stats->commits++;
+   stats->window_commits++;
+   if(now - stats->window_start >= NS_PER_SEC) {
+      stats->commits_per_sec = stats->window_start ? 
+         stats->window_commits * (float)NS_PER_SEC / (now - stats->window_start) : 0;
+      stats->window_start = now;
+      stats->window_commits = 0;
+   }
+
+   stats->damage_last = region_area(&surface->buffer_damage);
+   stats->damage_total += stats->damage_last;
+
+   // the committed buffer may already be uploaded and dropped, then its source is left
+   if(surface->current.committed & WLR_SURFACE_STATE_BUFFER) {
+      struct wlr_buffer *buffer = surface->current.buffer;
+      if(!buffer && surface->buffer) buffer = surface->buffer->source;
+      if(buffer || !surface->buffer)
+         stats->buffer_type = get_buffer_type(buffer);
+      stats->buffer_width = surface->current.buffer_width;
+      stats->buffer_height = surface->current.buffer_height;
+   }
+
+   if(output && output->last_frame_ns)
+      stats->frame_commit_ms = (now - output->last_frame_ns)/1e6;
+}
+
+void
+surface_stats_configure(struct surface_stats *stats, uint32_t serial)
+{
+   // keep the time of the oldest unacked configure
+   if(!stats->configure_serial)
+      stats->configure_time = stats_now();
+   stats->configure_serial = serial;
+}
+
+void
+surface_stats_ack(struct surface_stats *stats, uint32_t serial)
+{
+   if(!stats->configure_serial || serial != stats->configure_serial) return;
+
+   stats->configure_ack_ms = (stats_now() - stats->configure_time)/1e6;
+   stats->configure_serial = 0;
+}
+
+void
+surface_stats_format(struct surface_stats *stats, char *buffer, size_t size)
+{
+   uint64_t now = stats_now();
+   float rate = stats->commits_per_sec;
+
+   // an idle surface doesn't commit, so its last full window is stale
+   if(stats->window_start && now - stats->window_start >= 2*NS_PER_SEC)
+      rate = stats->window_commits * (float)NS_PER_SEC / (now - stats->window_start);
+
+   snprintf(buffer, size, "%.1f commits/s (%llu total), damage %llu px/commit (last %llu), "
+         "buffer %dx%d %s, configure->ack %.2f ms, frame->commit %.2f ms",
+         rate, (unsigned long long)stats->commits,
+         (unsigned long long)(stats->commits ? stats->damage_total/stats->commits : 0),
+         (unsigned long long)stats->damage_last,
+         stats->buffer_width, stats->buffer_height, buffer_str[stats->buffer_type],
+         stats->configure_ack_ms, stats->frame_commit_ms);
+}
+
+//------------------------------------------------------------------------
+#define STARTUP_PHASES 24
+
+static struct {
+   const char *name;
+   uint64_t ns;
+} phases[STARTUP_PHASES];
+static int n_phases;
+
+void
+startup_mark(const char *name)
+{
+   if(n_phases == STARTUP_PHASES) return;
+   phases[n_phases].name = name;
+   phases[n_phases++].ns = stats_now();
+}
+
+void
+startup_report(void (*emit)(const char*, void*), void *data)
+{
+   char line[128];
+
+   for(int i=0; i<n_phases; i++) {
+      snprintf(line, sizeof line, "%-20s %8.2f ms (+%.2f ms)", phases[i].name, 
+            (phases[i].ns - phases[0].ns)/1e6, i ? (phases[i].ns - phases[i-1].ns)/1e6 : 0.0);
+      emit(line, data);
+   }
+}
@@ -0,0 +1,387 @@
+/*
+ * trace.c
+ *   - records listener callbacks, frames and IPC requests as Trace Event
+ *     JSON (chrome://tracing, ui.perfetto.dev), enabled by --trace <file>
+ *   - stall watchdog timing each event loop dispatch, enabled by stall_budget_ms
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#include "globals.h"
+#include "trace.h"
+
+#define TRACE_BUFFER_EVENTS 4096
+
+struct trace_event {
+   const char *name;    // handler name from LISTEN(), a string literal
+   uint64_t start;      // ns, CLOCK_MONOTONIC
+   uint64_t duration;
+};
+
+struct trace_buffer {
+   struct trace_event events[TRACE_BUFFER_EVENTS];
+   int n;
+};
+
+// handler registered for each traced wl_listener, keyed by its address
+struct trace_slot {
+   struct wl_listener *listener;
+   wl_notify_func_t notify;
+   const char *name;
+};
+
+static FILE *trace_file;
+static bool first_event;
+static unsigned long dropped;
+
+// events are recorded into 'recording'; full buffers go to the writer thread
+static struct trace_buffer buffers[2];
+static struct trace_buffer *recording;
+static struct trace_buffer *writing;
+static pthread_t writer;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static bool writer_done;
+
+static struct trace_slot *slots;
+static size_t n_slots, used_slots;
+
+// dispatch currently running, watched by the monitor thread, and the
+// outermost handler inside it
+static int depth;
+static uint64_t stall_budget;
+static _Atomic(const char*) dispatch_name;
+static _Atomic(const char*) running_name;
+static atomic_uint_least64_t running_start;
+static const char *slowest_name;   // slowest outermost handler of this dispatch
+static uint64_t slowest_ns;
+static pthread_t monitor;
+static struct trace_stats stats;
+
+//------------------------------------------------------------------------
+static uint64_t
+now_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static void
+write_buffer(struct trace_buffer *buffer)
+{
+   for(int i=0; i<buffer->n; i++) {
+      struct trace_event *ev = &buffer->events[i];
+      fprintf(trace_file, "%s\n{\"name\":\"%s\",\"cat\":\"simplewc\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+            "\"ts\":%.3f,\"dur\":%.3f}", first_event ? "" : ",", ev->name, ev->start/1000.0, ev->duration/1000.0);
+      first_event = false;
+   }
+   buffer->n = 0;
+}
+
+static void*
+writer_thread(void *data)
+{
+   pthread_mutex_lock(&writer_lock);
+   for(;;) {
+      while(!writing && !writer_done)
+         pthread_cond_wait(&writer_cond, &writer_lock);
+      if(!writing) break;
+
+      struct trace_buffer *buffer = writing;
+      pthread_mutex_unlock(&writer_lock);
+      write_buffer(buffer);
+      fflush(trace_file);
+      pthread_mutex_lock(&writer_lock);
+
+      writing = NULL;
+      pthread_cond_signal(&writer_cond);
+   }
+   pthread_mutex_unlock(&writer_lock);
+   return NULL;
+}
+
+// hand the recording buffer to the writer, or drop it if the writer is still busy
+static void
+swap_buffers()
+{
+   pthread_mutex_lock(&writer_lock);
+   if(writing) {
+      dropped += recording->n;
+      recording->n = 0;
+   } else {
+      writing = recording;
+      recording = recording==&buffers[0] ? &buffers[1] : &buffers[0];
+      pthread_cond_signal(&writer_cond);
+   }
+   pthread_mutex_unlock(&writer_lock);
+}
+
+static void
+record(const char *name, uint64_t start, uint64_t end)
+{
+   struct trace_event *ev = &recording->events[recording->n++];
+   ev->name = name;
+   ev->start = start;
+   ev->duration = end - start;
+
+   if(recording->n==TRACE_BUFFER_EVENTS)
+      swap_buffers();
+}
+
+//------------------------------------------------------------------------
+static size_t
+slot_index(struct wl_listener *listener, size_t size)
+{
+   return ((uintptr_t)listener >> 4) * 2654435761u & (size-1);
+}
+
+static struct trace_slot*
+find_slot(struct wl_listener *listener)
+{
+   size_t i = slot_index(listener, n_slots);
+   while(slots[i].listener && slots[i].listener!=listener)
+      i = (i+1) & (n_slots-1);
+   return &slots[i];
+}
+
+static void
+grow_slots()
+{
+   struct trace_slot *old = slots;
+   size_t n_old = n_slots;
+
+   n_slots = n_slots ? n_slots*2 : 256;
+   if(!(slots = calloc(n_slots, sizeof(struct trace_slot))))
+      say(ERROR, "Cannot allocate trace table");
+
+   for(size_t i=0; i<n_old; i++)
+      if(old[i].listener) *find_slot(old[i].listener) = old[i];
+   free(old);
+}
+
+// backward shift deletion, so probing needs no tombstones
+static void
+clear_slot(struct trace_slot *slot)
+{
+   size_t hole = slot - slots;
+   for(size_t i = (hole+1) & (n_slots-1); slots[i].listener; i = (i+1) & (n_slots-1)) {
+      size_t home = slot_index(slots[i].listener, n_slots);
+      // entries whose home is cyclically in (hole, i] stay where they are
+      if(hole<=i ? (home>hole && home<=i) : (home>hole || home<=i)) continue;
+      slots[hole] = slots[i];
+      hole = i;
+   }
+   slots[hole] = (struct trace_slot){ 0 };
+   used_slots--;
+}
+
+static uint64_t
+enter(const char *name)
+{
+   uint64_t start = now_ns();
+   if(depth++==0 && stall_budget)
+      atomic_store_explicit(&running_name, name, memory_order_relaxed);
+   return start;
+}
+
+static void
+leave(const char *name, uint64_t start)
+{
+   uint64_t end = now_ns();
+   if(trace_file) record(name, start, end);
+
+   if(--depth>0 || !stall_budget) return;
+   atomic_store_explicit(&running_name, NULL, memory_order_relaxed);
+
+   // only names the stall, the budget applies to the whole dispatch
+   if(end - start > slowest_ns) {
+      slowest_ns = end - start;
+      slowest_name = name;
+   }
+}
+
+static void
+traced_notify(struct wl_listener *listener, void *data)
+{
+   struct trace_slot *slot = find_slot(listener);
+   if(!slot->listener) return;
+
+   // copy first, the handler may register this listener again
+   wl_notify_func_t notify = slot->notify;
+   const char *name = slot->name;
+
+   uint64_t start = enter(name);
+   notify(listener, data);
+   leave(name, start);
+}
+
+// reports a dispatch that is still running past the budget, e.g. blocked in a syscall
+static void*
+monitor_thread(void *data)
+{
+   uint64_t reported = 0;
+   struct timespec interval = { stall_budget/2/1000000000, stall_budget/2%1000000000 };
+
+   for(;;) {
+      nanosleep(&interval, NULL);
+
+      uint64_t start = atomic_load_explicit(&running_start, memory_order_acquire);
+      if(!start || start==reported || now_ns() - start <= stall_budget) continue;
+
+      // the names belong to this dispatch only if it is still the one running
+      const char *dispatch = atomic_load_explicit(&dispatch_name, memory_order_relaxed);
+      const char *name = atomic_load_explicit(&running_name, memory_order_relaxed);
+      atomic_thread_fence(memory_order_acquire);
+      if(atomic_load_explicit(&running_start, memory_order_relaxed) != start) continue;
+
+      reported = start;
+      say(WARNING, "Stall: %s dispatch has been running for %.1f ms%s%s", dispatch,
+            (now_ns() - start)/1e6, name ? ", in " : "", name ? name : "");
+   }
+   return NULL;
+}
+
+//------------------------------------------------------------------------
+bool
+trace_enabled()
+{
+   return trace_file!=NULL;
+}
+
+bool
+trace_start(const char *filename)
+{
+   if(!(trace_file = fopen(filename, "w"))) {
+      say(WARNING, "Cannot open trace file %s", filename);
+      return false;
+   }
+
+   fprintf(trace_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+   first_event = true;
+   recording = &buffers[0];
+
+   if(pthread_create(&writer, NULL, writer_thread, NULL)) {
+      say(WARNING, "Cannot start trace writer");
+      fclose(trace_file);
+      trace_file = NULL;
+      return false;
+   }
+   say(INFO, "Tracing to %s", filename);
+   return true;
+}
+
+void
+trace_finish()
+{
+   if(!trace_file) return;
+
+   pthread_mutex_lock(&writer_lock);
+   writer_done = true;
+   pthread_cond_signal(&writer_cond);
+   pthread_mutex_unlock(&writer_lock);
+   pthread_join(writer, NULL);
+
+   write_buffer(recording);
+   fprintf(trace_file, "\n]}\n");
+   fclose(trace_file);
+   trace_file = NULL;
+
+   // the handler table stays, listeners keep pointing at traced_notify()
+   if(dropped)
+      say(WARNING, "Trace writer fell behind, %lu events dropped", dropped);
+}
+
+void
+trace_watchdog(int budget_ms)
+{
+   if(budget_ms<=0) return;
+
+   stall_budget = (uint64_t)budget_ms*1000000;
+   if(pthread_create(&monitor, NULL, monitor_thread, NULL))
+      say(WARNING, "Cannot start stall monitor");
+   else
+      pthread_detach(monitor);
+   say(INFO, "Stall watchdog budget %d ms", budget_ms);
+}
+
+void
+trace_get_stats(struct trace_stats *out)
+{
+   *out = stats;
+}
+
+// LISTEN() hook: returns the handler itself unless tracing or the watchdog is on
+wl_notify_func_t
+trace_listener(struct wl_listener *listener, wl_notify_func_t notify, const char *name)
+{
+   if(!trace_file && !stall_budget) return notify;
+
+   if(2*(used_slots+1) > n_slots) grow_slots();
+
+   struct trace_slot *slot = find_slot(listener);
+   if(!slot->listener) used_slots++;
+   *slot = (struct trace_slot){ listener, notify, name };
+   return traced_notify;
+}
+
+// called by runServer() around each dispatch of a loop, 'name' is a string literal
+void
+trace_dispatch_begin(const char *name)
+{
+   if(!stall_budget) return;
+
+   atomic_store_explicit(&dispatch_name, name, memory_order_relaxed);
+   slowest_name = NULL;
+   slowest_ns = 0;
+   atomic_store_explicit(&running_start, now_ns(), memory_order_release);
+}
+
+void
+trace_dispatch_end()
+{
+   if(!stall_budget) return;
+
+   uint64_t start = atomic_load_explicit(&running_start, memory_order_relaxed);
+   atomic_store_explicit(&running_start, 0, memory_order_release);
+
+   uint64_t duration = now_ns() - start;
+   if(!start || duration <= stall_budget) return;
+
+   const char *dispatch = atomic_load_explicit(&dispatch_name, memory_order_relaxed);
+   const char *name = slowest_name ? slowest_name : dispatch;
+   stats.stalls++;
+   if(duration > stats.worst_ns) {
+      stats.worst_ns = duration;
+      stats.worst_name = name;
+   }
+   if(slowest_name)
+      say(WARNING, "Stall: %s dispatch took %.1f ms, %s %.1f ms of it", dispatch, duration/1e6, slowest_name, slowest_ns/1e6);
+   else
+      say(WARNING, "Stall: %s dispatch took %.1f ms", dispatch, duration/1e6);
+}
+
+// UNLISTEN() hook, so the table only holds listeners that are still added
+void
+trace_unlisten(struct wl_listener *listener)
+{
+   if(!n_slots) return;
+
+   struct trace_slot *slot = find_slot(listener);
+   if(slot->listener) clear_slot(slot);
+}
+
+uint64_t
+trace_begin(const char *name)
+{
+   return trace_file || stall_budget ? enter(name) : 0;
+}
+
+void
+trace_end(const char *name, uint64_t start)
+{
+   if(start) leave(name, start);
+}
@@ -0,0 +1,188 @@
+#include <pthread.h>
+#include <string.h>
+#include <sys/eventfd.h>
+
+#include "globals.h"
+#include "worker.h"
+
+#define MAX_WORKERS 8
+
+struct job {
+   void (*run)(void*);
+   void (*done)(void*);
+   void (*cancel)(void*);
+   void *data;
+   struct job *next;
+};
+
+struct job_queue {
+   struct job *head, *tail;
+};
+
+// jobs waiting for a thread, and finished ones waiting for the event loop;
+// both under the one lock
+static struct {
+   pthread_t threads[MAX_WORKERS];
+   int n_threads;
+
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   struct job_queue waiting;
+   struct job_queue finished;
+   bool stopping;
+
+   int efd;
+   struct wl_event_source *source;
+} pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER, .efd = -1 };
+
+//------------------------------------------------------------------------
+static void
+queue_push(struct job_queue *queue, struct job *job)
+{
+   job->next = NULL;
+   if(queue->tail) queue->tail->next = job;
+   else            queue->head = job;
+   queue->tail = job;
+}
+
+static struct job*
+queue_pop(struct job_queue *queue)
+{
+   struct job *job = queue->head;
+   if(job && !(queue->head = job->next)) queue->tail = NULL;
+   return job;
+}
+
+static void*
+worker_thread(void *data)
+{
+   pthread_mutex_lock(&pool.lock);
+   for(;;) {
+      // jobs still queued when stopping are cancelled, not run
+      if(pool.stopping) break;
+      struct job *job = queue_pop(&pool.waiting);
+      if(!job) {
+         pthread_cond_wait(&pool.cond, &pool.lock);
+         continue;
+      }
+      pthread_mutex_unlock(&pool.lock);
+      job->run(job->data);
+      pthread_mutex_lock(&pool.lock);
+
+      queue_push(&pool.finished, job);
+      eventfd_write(pool.efd, 1);
+   }
+   pthread_mutex_unlock(&pool.lock);
+   return NULL;
+}
+
+// in the order they finished, on the compositor thread
+static void
+run_finished()
+{
+   pthread_mutex_lock(&pool.lock);
+   struct job *job = pool.finished.head;
+   pool.finished.head = pool.finished.tail = NULL;
+   pthread_mutex_unlock(&pool.lock);
+
+   while(job) {
+      struct job *next = job->next;
+      job->done(job->data);
+      free(job);
+      job = next;
+   }
+}
+
+static void
+cancel_queue(struct job_queue *queue)
+{
+   struct job *job;
+   while((job = queue_pop(queue))) {
+      job->cancel(job->data);
+      free(job);
+   }
+}
+
+static int
+finished_notify(int fd, uint32_t mask, void *data)
+{
+   eventfd_t count;
+   eventfd_read(fd, &count);
+   run_finished();
+   return 0;
+}
+
+//------------------------------------------------------------------------
+void
+worker_pool_start(int n_threads)
+{
+   if(n_threads<=0) return;
+   if((pool.efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+      say(WARNING, "Cannot create worker eventfd, jobs run on the main thread");
+      return;
+   }
+
+   for(int i=0; i<MIN(n_threads, MAX_WORKERS); i++) {
+      if(pthread_create(&pool.threads[pool.n_threads], NULL, worker_thread, NULL)) {
+         say(WARNING, "Cannot start worker thread");
+         break;
+      }
+      pool.n_threads++;
+   }
+   say(DEBUG, "Started %d worker threads", pool.n_threads);
+}
+
+// jobs finishing before this are run once the loop is up
+void
+worker_pool_listen(struct wl_event_loop *loop)
+{
+   if(pool.n_threads)
+      pool.source = wl_event_loop_add_fd(loop, pool.efd, WL_EVENT_READABLE, finished_notify, NULL);
+}
+
+void
+worker_pool_finish()
+{
+   if(!pool.n_threads) return;
+
+   pthread_mutex_lock(&pool.lock);
+   pool.stopping = true;
+   pthread_cond_broadcast(&pool.cond);
+   pthread_mutex_unlock(&pool.lock);
+
+   for(int i=0; i<pool.n_threads; i++)
+      pthread_join(pool.threads[i], NULL);
+   pool.n_threads = 0;
+
+   // the event loop is gone, done() must not re-arm anything in it
+   cancel_queue(&pool.waiting);
+   cancel_queue(&pool.finished);
+
+   if(pool.source) wl_event_source_remove(pool.source);
+   close(pool.efd);
+   pool.source = NULL;
+   pool.efd = -1;
+}
+
+// run() must not touch wlroots or the compositor state, done() does that;
+// cancel() only frees 'data', for jobs still pending at shutdown
+void
+worker_submit(void (*run)(void*), void (*done)(void*), void (*cancel)(void*), void *data)
+{
+   struct job *job;
+   if(!pool.n_threads || !(job = calloc(1, sizeof(struct job)))) {
+      run(data);
+      done(data);
+      return;
+   }
+
+   job->run = run;
+   job->done = done;
+   job->cancel = cancel;
+   job->data = data;
+
+   pthread_mutex_lock(&pool.lock);
+   queue_push(&pool.waiting, job);
+   pthread_cond_signal(&pool.cond);
+   pthread_mutex_unlock(&pool.lock);
+}
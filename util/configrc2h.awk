@@ -0,0 +1,141 @@
+# Generates include/builtin-config.h from a configrc, for builds with BUILTIN_CONFIG.
+# Only the syntax readConfiguration() accepts is understood; settings it does not
+# know are skipped, as they are at runtime.
+#
+#   awk -f util/configrc2h.awk config/configrc > include/builtin-config.h
+
+function trim(s) {
+   sub(/^[ \t\r]+/, "", s)
+   sub(/[ \t\r]+$/, "", s)
+   return s
+}
+
+function quote(s) {
+   gsub(/\\/, "\\\\", s)
+   gsub(/"/, "\\\"", s)
+   return "\"" s "\""
+}
+
+function hex(s,    i, v) {
+   v = 0
+   s = tolower(s)
+   for(i=1; i<=length(s); i++) v = v*16 + index("0123456789abcdef", substr(s, i, 1)) - 1
+   return v
+}
+
+function colour(field, value) {
+   sub(/^#/, "", value)
+   if(value !~ /^[0-9A-Fa-f][0-9A-Fa-f][0-9A-Fa-f][0-9A-Fa-f][0-9A-Fa-f][0-9A-Fa-f]$/) return
+   settings[n_settings++] = sprintf("   memcpy(config->%s, (float[4]){ %.6ff, %.6ff, %.6ff, 1.0f }, sizeof(float[4]));", \
+         field, hex(substr(value, 1, 2))/255, hex(substr(value, 3, 2))/255, hex(substr(value, 5, 2))/255)
+}
+
+function modifiers(parts, n,    i, mod) {
+   mod = ""
+   for(i=1; i<n; i++) {
+      if(parts[i]=="S") mod = mod "|WLR_MODIFIER_SHIFT"
+      if(parts[i]=="C") mod = mod "|WLR_MODIFIER_CTRL"
+      if(parts[i]=="A") mod = mod "|WLR_MODIFIER_ALT"
+      if(parts[i]=="W") mod = mod "|WLR_MODIFIER_LOGO"
+   }
+   return mod=="" ? "0" : substr(mod, 2)
+}
+
+BEGIN {
+   ints["n_tags"]; ints["border_width"]; ints["tile_gap_width"]; ints["moveresize_step"]
+   ints["snap_distance"]; ints["xwayland_idle_timeout"]; ints["stall_budget_ms"]
+   ints["ping_interval"]; ints["ping_timeout_ms"]; ints["realtime_priority"]; ints["dispatch_budget_us"]; ints["worker_threads"]
+   budgets["client_max_surfaces"] = "BUDGET_SURFACES"; budgets["client_max_windows"] = "BUDGET_WINDOWS"
+   budgets["client_max_popups"] = "BUDGET_POPUPS"; budgets["client_max_commits"] = "BUDGET_COMMITS"
+   bools["client_budget_disconnect"]
+   bools["sloppy_focus"]; bools["smart_placement"]; bools["touchpad_tap_click"]
+   strings["lock_cmd"]; strings["metrics_socket"]; strings["spawn_cgroup"]; strings["privileged_clients"]; strings["xkb_layout"]; strings["xkb_options"]
+   strings["autostart"] = "autostart_script"
+   colours["background_colour"] = "background_colour"
+   colours["border_colour_focus"] = "border_colour[FOCUSED]"
+   colours["border_colour_unfocus"] = "border_colour[UNFOCUSED]"
+   colours["border_colour_urgent"] = "border_colour[URGENT]"
+   colours["border_colour_marked"] = "border_colour[MARKED]"
+   colours["border_colour_fixed"] = "border_colour[FIXED]"
+   colours["border_colour_outline"] = "border_colour[OUTLINE]"
+   functions["QUIT"]; functions["LOCK"]; functions["TAG"]; functions["SPAWN"]; functions["CLIENT"]
+}
+
+/^[ \t]*(#|$)/ || index($0, "=")==0 { next }
+
+{
+   eq = index($0, "=")
+   id = trim(substr($0, 1, eq-1))
+   value = trim(substr($0, eq+1))
+   n = split(value, words, /[ \t]+/)
+
+   if(id in ints) {
+      v = int(value)
+      if((id=="xwayland_idle_timeout" || id=="stall_budget_ms" || id=="ping_interval" || id=="dispatch_budget_us" || id=="worker_threads") && v<0) v = 0
+      if(id=="ping_timeout_ms" && v<100) v = 100
+      if(id=="realtime_priority") v = v<1 ? 1 : v>99 ? 99 : v
+      settings[n_settings++] = sprintf("   config->%s = %d;", id, v)
+   }
+   else if(id in budgets)  settings[n_settings++] = sprintf("   config->client_budget[%s] = %d;", budgets[id], int(value)<0 ? 0 : int(value))
+   else if(id in bools)    settings[n_settings++] = sprintf("   config->%s = %s;", id, value=="true" ? "true" : "false")
+   else if(id in colours)  colour(colours[id], value)
+   else if(id in strings) {
+      field = strings[id]=="" ? id : strings[id]
+      settings[n_settings++] = sprintf("   strncpy(config->%s, %s, sizeof config->%s);", field, quote(value), field)
+   }
+   else if(id ~ /^global_/ && (value=="off" || value=="on" || value=="privileged")) {
+      settings[n_settings++] = sprintf("   config->global_access[GLOBAL_%s] = ACCESS_%s;", toupper(substr(id, 8)), toupper(value))
+   }
+   else if(id=="realtime") {
+      settings[n_settings++] = sprintf("   config->realtime = %s;", value=="rr" ? "REALTIME_RR" : value=="fifo" ? "REALTIME_FIFO" : "REALTIME_OFF")
+   }
+   else if(id=="watch_config") {
+      print "configrc2h: watch_config is ignored in a built-in configuration" > "/dev/stderr"
+   }
+   else if(id=="KEY" && n>=2) {
+      np = split(words[1], parts, "+")
+      fn = (words[2] in functions) ? words[2] : "-1"
+      arg = value; sub(/^[^ \t]+[ \t]+[^ \t]+[ \t]*/, "", arg)
+      keys[n_keys++] = sprintf("   { %s, XKB_KEY_%s, %s, %s },", modifiers(parts, np), parts[np], fn, quote(arg))
+   }
+   else if(id=="MOUSE" && n>=2) {
+      np = split(words[1], parts, "+")
+      button = parts[np]=="Button_Left" ? "BTN_LEFT" : parts[np]=="Button_Right" ? "BTN_RIGHT" : parts[np]=="Button_Middle" ? "BTN_MIDDLE" : "0"
+      context = words[2]=="ROOT" ? "CONTEXT_ROOT" : words[2]=="CLIENT" ? "CONTEXT_CLIENT" : "-1"
+      arg = value; sub(/^[^ \t]+[ \t]+[^ \t]+[ \t]*/, "", arg)
+      buttons[n_buttons++] = sprintf("   { %s, %s, %s, %s },", modifiers(parts, np), button, context, quote(arg))
+   }
+   else if(id=="RULE") {
+      rules[n_rules++] = sprintf("   %s,", quote(value))
+   }
+}
+
+END {
+   print "// generated from " FILENAME " by util/configrc2h.awk, do not edit"
+   print "#ifndef BUILTIN_CONFIG_H"
+   print "#define BUILTIN_CONFIG_H"
+   print ""
+   print "#define N_BUILTIN_KEY_BINDINGS " n_keys+0
+   print "#define N_BUILTIN_MOUSE_BINDINGS " n_buttons+0
+   print ""
+   print "static const struct keymap builtin_key_bindings[MAX(1, N_BUILTIN_KEY_BINDINGS)] = {"
+   for(i=0; i<n_keys; i++) print keys[i]
+   print "};"
+   print ""
+   print "static const struct mousemap builtin_mouse_bindings[MAX(1, N_BUILTIN_MOUSE_BINDINGS)] = {"
+   for(i=0; i<n_buttons; i++) print buttons[i]
+   print "};"
+   print ""
+   print "static const char *builtin_rules[] = {"
+   for(i=0; i<n_rules; i++) print rules[i]
+   print "   NULL"
+   print "};"
+   print ""
+   print "static void"
+   print "builtin_settings(struct simple_config *config)"
+   print "{"
+   for(i=0; i<n_settings; i++) print settings[i]
+   print "}"
+   print ""
+   print "#endif"
+}
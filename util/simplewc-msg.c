@@ -28,6 +28,7 @@ bool flag_tagcount;
 bool flag_tag;
 bool flag_output;
 bool flag_client;
+bool flag_client_stats;
 
 struct output {
    char *output_name;
@@ -62,11 +63,15 @@ say(int level, const char* message, ...)
    if(level==ERROR) exit(EXIT_FAILURE);
 }
 
+void send_action(const char*);
+
 //------------------------------------------------------------------------
 static void simple_ipc_tags(void *, struct zdwl_ipc_manager_v2 *, uint32_t);
+static void simple_ipc_message(void *, struct zdwl_ipc_manager_v2 *, const char*);
 static const struct zdwl_ipc_manager_v2_listener ipc_listener = {
    .tags = simple_ipc_tags,
    .layout = noop,
+   .message = simple_ipc_message,
 };
 
 void
@@ -77,6 +82,12 @@ simple_ipc_tags(void *data, struct zdwl_ipc_manager_v2 *ipc_manager, uint32_t co
       say(INFO, "Server: tagcount = %d\n", tagcount);
 }
 
+void
+simple_ipc_message(void *data, struct zdwl_ipc_manager_v2 *ipc_manager, const char *text)
+{
+   printf("%s\n", text);
+}
+
 //------------------------------------------------------------------------
 static void simple_ipc_output_active(void *, struct zdwl_ipc_output_v2 *, uint32_t);
 static void simple_ipc_output_tag(void *, struct zdwl_ipc_output_v2 *, uint32_t, uint32_t, uint32_t, uint32_t);
@@ -161,7 +172,7 @@ simple_ipc_output_frame(void *data, struct zdwl_ipc_output_v2 *dwl_ipc_output)
       strcpy(new_arg, "output_");
       strcat(new_arg, arg);
       say(INFO, "new_arg = %s\n", new_arg);
-      zdwl_ipc_manager_v2_send_action(ipc_manager, new_arg);
+      send_action(new_arg);
 
       wl_display_flush(display);
       return;
@@ -249,7 +260,8 @@ global_add(void *data, struct wl_registry *wl_registry, uint32_t name, const cha
       outputs[outputcount].name = name;
       outputcount++;
    } else if (!strcmp(interface, zdwl_ipc_manager_v2_interface.name)) {
-      ipc_manager = wl_registry_bind(wl_registry, name, &zdwl_ipc_manager_v2_interface, 2);
+      // replies to actions need version 3, older compositors just run them
+      ipc_manager = wl_registry_bind(wl_registry, name, &zdwl_ipc_manager_v2_interface, version < 3 ? version : 3);
       zdwl_ipc_manager_v2_add_listener(ipc_manager, &ipc_listener, NULL);
    }
 }
@@ -318,12 +330,15 @@ main(int argc, char **argv)
          if(!strcmp(iarg, "--tag")){
             flag_tag = true;
          }
+         if(!strcmp(iarg, "--client-stats")){
+            flag_client_stats = true;
+         }
       } else if(mode==ACTION) {
          say(INFO, "iarg = %s\n", iarg);
          sprintf(arg, iarg ? iarg:"noop" );
       }
    }
-   if(mode&GET && !(flag_tagcount || flag_tag || flag_output || flag_client)){
+   if(mode&GET && !(flag_tagcount || flag_tag || flag_output || flag_client || flag_client_stats)){
       say(INFO, "all flags\n");
       sprintf(arg, "all");
       flag_tagcount = flag_tag = flag_output = flag_client = 1;
@@ -343,6 +358,8 @@ main(int argc, char **argv)
 
    if(mode==ACTION) 
       send_action(arg);
+   if(mode==GET && flag_client_stats)
+      send_action("client_stats");
 
    wl_display_roundtrip(display);
 